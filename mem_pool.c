@@ -5,21 +5,56 @@
  * UC Denver Spring 2018
  */
 
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS, madvise() and mincore()
+
 #include <stdlib.h>
+#include <stdint.h> // for uintptr_t
 #include <assert.h>
 #include <stdio.h> // for perror()
+#include <sys/mman.h> // for POOL_MMAP
+#include <sys/stat.h>
+#include <fcntl.h>    // for mem_pool_open_file()
+#include <unistd.h>
 
-#include <memory.h>// for memcpy()
+#include <memory.h>// for memset()
+#include <string.h> // for strcmp()
 #include "mem_pool.h"
 
+// a thread-safe build gives every pool a mutex, held by each call on
+// the pool, and guards the pool store with one more
+#ifdef MEM_POOL_THREAD_SAFE
+#include <pthread.h>
+#define MEM_POOL_LOCK_INIT(pool_mgr)    pthread_mutex_init(&(pool_mgr)->lock, NULL)
+#define MEM_POOL_LOCK_DESTROY(pool_mgr) pthread_mutex_destroy(&(pool_mgr)->lock)
+#define MEM_POOL_LOCK(pool)             pthread_mutex_lock(&((pool_mgr_pt) (pool))->lock)
+#define MEM_POOL_UNLOCK(pool)           pthread_mutex_unlock(&((pool_mgr_pt) (pool))->lock)
+#define MEM_POOL_TRYLOCK(pool)          (pthread_mutex_trylock(&((pool_mgr_pt) (pool))->lock) == 0)
+#define MEM_STORE_LOCK()                pthread_mutex_lock(&pool_store_lock)
+#define MEM_STORE_UNLOCK()              pthread_mutex_unlock(&pool_store_lock)
+#define MEM_ATOMIC_ADD(var, n)          __atomic_add_fetch(&(var), (n), __ATOMIC_RELAXED)
+#else
+#define MEM_POOL_LOCK_INIT(pool_mgr)    ((void) 0)
+#define MEM_POOL_LOCK_DESTROY(pool_mgr) ((void) 0)
+#define MEM_POOL_LOCK(pool)             ((void) 0)
+#define MEM_POOL_UNLOCK(pool)           ((void) 0)
+#define MEM_POOL_TRYLOCK(pool)          (1)
+#define MEM_STORE_LOCK()                ((void) 0)
+#define MEM_STORE_UNLOCK()              ((void) 0)
+#define MEM_ATOMIC_ADD(var, n)          ((var) += (n))
+#endif
+
+// the FIRST_FIT search has SSE4.2 and AVX2 kernels on x86-64, picked at
+// run time by mem_init(); elsewhere it is a plain loop
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MEM_SCAN_X86
+#include <immintrin.h>
+#endif
+
 /*************/
 /*           */
 /* Constants */
 /*           */
 /*************/
-static const float      MEM_FILL_FACTOR                 = 0.75;
-static const unsigned   MEM_EXPAND_FACTOR               = 2;
-
 static const unsigned   MEM_POOL_STORE_INIT_CAPACITY    = 20;
 static const float      MEM_POOL_STORE_FILL_FACTOR      = 0.75;
 static const unsigned   MEM_POOL_STORE_EXPAND_FACTOR    = 2;
@@ -27,10 +62,78 @@ static const unsigned   MEM_POOL_STORE_EXPAND_FACTOR    = 2;
 static const unsigned   MEM_NODE_HEAP_INIT_CAPACITY     = 40;
 static const float      MEM_NODE_HEAP_FILL_FACTOR       = 0.75;
 static const unsigned   MEM_NODE_HEAP_EXPAND_FACTOR     = 2;
+// every chunk grows the heap by the expand factor, so this many chunks
+// already cover more nodes than an unsigned can count
+#define                 MEM_NODE_HEAP_MAX_CHUNKS        32
 
 static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
+static const unsigned   MEM_GAP_IX_NIL                  = (unsigned) -1;
+
+// TLSF_FIT size classes: first level is the power of two, second level
+// splits each power of two into 2^MEM_TLSF_SL_LOG2 linear subranges
+#define                 MEM_TLSF_SL_LOG2                4
+#define                 MEM_TLSF_SL_COUNT               (1 << MEM_TLSF_SL_LOG2)
+#define                 MEM_TLSF_FL_COUNT               64
+// gaps of the request's own class tried when no larger class has one
+#define                 MEM_TLSF_PROBES                 4
+
+// BUDDY blocks are powers of two of at least this order
+static const unsigned   MEM_BUDDY_MIN_ORDER             = 4;
+
+// mem_new_alloc_aligned() alignments; pool memory starts on a page, so
+// BUDDY and FIXED blocks are aligned to addresses, not just to offsets
+static const size_t     MEM_ALIGN_MIN                   = 8;
+static const size_t     MEM_ALIGN_MAX                   = 4096;
+static const size_t     MEM_BUMP_NONE                   = (size_t) -1;
+
+// POOL_MMAP: a gap gives its whole pages back to the system once this
+// many bytes have been freed into it; mem_pool_purge() gives back the rest
+static const size_t     MEM_RELEASE_MIN                 = 65536;
+
+// POOL_HUGE: pool memory is mapped, and given back, in pages of this size
+static const size_t     MEM_HUGE_PAGE                   = 2 * 1024 * 1024;
+
+// file pools: the file starts with a header, the pool memory comes
+// next, and the allocation records last, see mem_pool_open_file(). The
+// records are kept in one of two tables, and the header names the one
+// that is current. The library marks such pools with a flag of its own,
+// past the pool_flags.
+#define                 MEM_POOL_FILE                   (1u << 31)
+// the header takes as much of the file as the largest page size in use,
+// so that the pool memory after it can be mapped on any system
+static const size_t     MEM_FILE_DATA                   = 65536;
+static const char       MEM_FILE_MAGIC[8]               = { 'M', 'E', 'M', 'P', 'O', 'O', 'L', '1' };
+
+// POOL_SLAB: objects of 16, 32, 64, 128 and 256 bytes are cut from slabs
+// that are themselves MEM_SLAB_SIZE allocations of the pool
+#define                 MEM_SLAB_SIZE                   4096
+#define                 MEM_SLAB_MIN_ORDER              4
+#define                 MEM_SLAB_NUM_CLASSES            5
+#define                 MEM_SLAB_MAX_SIZE               (1 << (MEM_SLAB_MIN_ORDER + MEM_SLAB_NUM_CLASSES - 1))
+#define                 MEM_SLAB_MAX_OBJS               (MEM_SLAB_SIZE >> MEM_SLAB_MIN_ORDER)
+#define                 MEM_SLAB_MAP_WORDS              (MEM_SLAB_MAX_OBJS / 64)
+
+// POOL_TCACHE: a thread keeps up to MEM_TCACHE_SIZE objects per class,
+// and takes or gives back MEM_TCACHE_BATCH of them under one lock; it
+// finds its caches through a small direct-mapped table of its own
+#define                 MEM_TCACHE_SIZE                 32
+#define                 MEM_TCACHE_BATCH                16
+#define                 MEM_TCACHE_MAP_SIZE             8
+
+// frees left for the lock holder are done this many at a time, each batch
+// coalesced in one sweep, see _mem_remote_drain()
+#define                 MEM_REMOTE_BATCH                64
+// which free has a node: none, a remote free that has pushed it onto the
+// remote free list, or the lock holder, see _mem_node_claim()
+#define                 MEM_CLAIM_NONE                  0
+#define                 MEM_CLAIM_REMOTE                1
+#define                 MEM_CLAIM_LOCK                  2
+
+// a growable pool has at most this many regions, each at least twice the
+// size of the one before, see _mem_grow()
+#define                 MEM_MAX_REGIONS                 32
 
 
 
@@ -47,24 +150,174 @@ typedef struct _alloc {
 typedef struct _node {
     alloc_t alloc_record;
     unsigned used;
-    unsigned allocated;
+    unsigned allocated; // read without the lock by _mem_remote_free, so
+                        // it is only written atomically
+    unsigned gap_slot; // entry in the gap index while this node is a gap
+#ifdef MEM_POOL_THREAD_SAFE
+    unsigned claim;    // the free that has the node, see _mem_node_claim
+#endif
     struct _node *next, *prev; // doubly-linked list for gap deletion
+    // a gap is never on the remote free list, and an allocation there is
+    // freed before anything reads its dirty count, so the two share room
+    union {
+        size_t dirty;      // POOL_MMAP gaps: bytes freed into the gap since its
+                           // pages were last given back, see _mem_release_gap
+#ifdef MEM_POOL_THREAD_SAFE
+        void *remote_next; // the pool's remote free list, see _mem_remote_free
+#endif
+    };
 } node_t, *node_pt;
 
+// The gap index is an AVL tree ordered by (size, node address), stored in
+// the gap_ix array. Links are slot indices, so growing gap_ix with realloc()
+// does not invalidate them. MEM_GAP_IX_NIL marks a missing child.
+// In a TLSF_FIT pool the same slots instead form one doubly-linked list
+// per size class, with left/right serving as prev/next.
+// A FIRST_FIT pool files its gaps in address order in the parallel arrays
+// ff_mem, ff_size and ff_node instead, so a first-fit search streams
+// through the dense ff_size array rather than chasing node links.
+// The node heap is a list of chunks that are never moved or copied, so
+// nodes (and the handles returned to the user) keep their addresses
+// for the lifetime of the pool.
+typedef struct _node_chunk {
+    node_pt nodes;
+    unsigned capacity;
+} node_chunk_t, *node_chunk_pt;
+
 typedef struct _gap {
     size_t size;
     node_pt node;
+    unsigned left, right; // child slots; a free slot links on through left
+    unsigned height;      // height of the subtree rooted at this slot
 } gap_t, *gap_pt;
 
+// A slab's bookkeeping lives outside the pool, so its objects are handed
+// out as plain addresses into pool memory, which never collide with the
+// node handles of regular allocations.
+typedef struct _slab {
+    char *mem;
+    node_pt node;           // the pool allocation holding the slab
+    unsigned size_class;
+    unsigned obj_size;
+    unsigned num_objs;
+    unsigned num_free;
+    uint64_t free_map[MEM_SLAB_MAP_WORDS];      // a set bit marks a free object
+    uint64_t live_map[MEM_SLAB_MAP_WORDS];      // POOL_TCACHE: a set bit marks an
+                                                // object the user holds, see
+                                                // _mem_tcache_free
+    unsigned short req_size[MEM_SLAB_MAX_OBJS]; // bytes asked for, per object
+    struct _slab *next, *prev; // list of slabs of the class with free objects
+} slab_t, *slab_pt;
+
+// A thread's cache of free slab objects for one POOL_TCACHE pool. Its
+// objects still count as allocated in the pool metadata. The pool owns
+// the caches of all threads, so it can drain them when it is closed; a
+// thread flushes its caches when it exits, see _mem_tcache_exit.
+typedef struct _tcache {
+    void *owner;            // identifies the thread, see _mem_tcache_get
+    struct _tcache *next;   // list of the pool's caches
+    struct _tcache *thread_next; // list of the owner thread's caches
+    struct _pool_mgr *pool_mgr;  // NULL once the pool is closed
+    unsigned count[MEM_SLAB_NUM_CLASSES];
+    void *objs[MEM_SLAB_NUM_CLASSES][MEM_TCACHE_SIZE]; // a stack per class
+} tcache_t, *tcache_pt;
+
 typedef struct _pool_mgr {
     pool_t pool;
-    node_pt node_heap;
-    unsigned total_nodes;
+    unsigned flags;         // pool_flags given at open
+    node_chunk_t node_heap[MEM_NODE_HEAP_MAX_CHUNKS];
+    unsigned num_chunks;    // only grows while the pool is in use, and a
+                            // chunk is filled in before it is counted
+    unsigned total_nodes;   // across all chunks
     unsigned used_nodes;
+    unsigned node_heap_top; // nodes [0, node_heap_top) of the last chunk
+                            // have been handed out
+    node_pt free_nodes;     // released nodes, linked through next
+    node_pt head;           // node of the first segment in the pool
+    node_pt rover;          // NEXT_FIT: node where the next search starts
     gap_pt gap_ix;
     unsigned gap_ix_capacity;
+    unsigned gap_ix_top;  // slots [0, gap_ix_top) have been handed out
+    unsigned gap_ix_free; // head of the list of released slots
+    unsigned gap_root;    // root slot of the gap tree
+    // FIRST_FIT only: gaps in address order in [0, ff_len), with the
+    // same capacity as the gap index. A removed gap may leave one hole
+    // (size 0, no node) behind, so that the gap that replaces it, as
+    // after a split or a merge, is written in place.
+    char **ff_mem;
+    size_t *ff_size;
+    node_pt *ff_node;
+    unsigned ff_len;
+    unsigned ff_hole;     // MEM_GAP_IX_NIL if there is none
+    // TLSF_FIT only: a set bit marks a non-empty class list, whose head
+    // slot is in tlsf_heads (stale while the bit is clear)
+    uint64_t tlsf_fl_bitmap;
+    unsigned tlsf_sl_bitmap[MEM_TLSF_FL_COUNT];
+    unsigned tlsf_heads[MEM_TLSF_FL_COUNT][MEM_TLSF_SL_COUNT];
+    // POOL_SLAB only: slabs with free objects per class, and for every
+    // MEM_SLAB_SIZE granule of the pool the slab that starts in it
+    slab_pt slab_partial[MEM_SLAB_NUM_CLASSES];
+    slab_pt *slab_map;
+    // POOL_TCACHE only: the caches of the threads using the pool
+    tcache_pt tcaches;
+    unsigned serial;        // tells the pool apart from earlier ones at
+                            // the same address, see _mem_store_add
+    // FIXED only: num_blocks blocks of block_size bytes; a set bit in
+    // block_map marks a free block, and no word before block_hint has one;
+    // a set bit in remote_map marks a block on the remote free list
+    size_t block_size;
+    unsigned num_blocks;
+    uint64_t *block_map;
+    uint64_t *remote_map;
+    unsigned block_hint;
+    // sharded pools only: the shards, each a pool of its own over a slice
+    // of the memory, in address order; a shard points back to its pool
+    struct _pool_mgr **shards;
+    unsigned num_shards;
+    struct _pool_mgr *sharded;
+    // growable pools only: the shards are regions, added as the pool runs
+    // out of room up to max_size bytes in all; regions past the first own
+    // their memory, so pool.mem and pool.total_size are the first region's
+    size_t max_size;
+    // BUMP only: [0, bump_top) of the pool is in use, and the last
+    // allocation starts at bump_last (MEM_BUMP_NONE if it is unknown)
+    size_t bump_top;
+    size_t bump_last;
+    // allocations freed while another thread held the lock, linked through
+    // their node or their memory, for the next thread to hold it to free
+    void *remote_frees;
+    // file pools only: the file the pool is mapped from
+    int file_fd;
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_t lock;   // held by every call on the pool
+#endif
 } pool_mgr_t, *pool_mgr_pt;
 
+// where a thread last found its cache of a pool
+typedef struct _tcache_map {
+    pool_mgr_pt pool_mgr;
+    unsigned serial;
+    tcache_pt cache;
+} tcache_map_t;
+
+// the header page of a pool's file; its fields have fixed sizes, so the
+// file reads the same in any build on the machine
+typedef struct _file_header {
+    char magic[8];
+    uint64_t size;
+    uint32_t policy;
+    uint32_t reserved;
+    uint64_t num_records;
+    uint64_t table;         // file offset of the current record table
+} file_header_t;
+
+// an allocation in a pool's file: an offset into the pool memory, which
+// holds wherever the file is mapped, rather than a pointer
+typedef struct _file_record {
+    uint64_t offset;
+    uint64_t size;
+} file_record_t;
+
 
 
 /***************************/
@@ -75,6 +328,29 @@ typedef struct _pool_mgr {
 static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
 static unsigned pool_store_size = 0;
 static unsigned pool_store_capacity = 0;
+#ifdef MEM_POOL_THREAD_SAFE
+static pthread_mutex_t pool_store_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static unsigned pool_serial = 0;  // serial of the last pool opened
+// the calling thread's caches, by pool, and the address of its owner
+// byte, which is what tells threads apart
+static _Thread_local tcache_map_t mem_tcache_map[MEM_TCACHE_MAP_SIZE];
+static _Thread_local char mem_tcache_owner;
+static _Thread_local tcache_pt mem_tcache_list = NULL;
+#ifdef MEM_POOL_THREAD_SAFE
+// its destructor flushes an exiting thread's caches
+static pthread_key_t mem_tcache_key;
+static pthread_once_t mem_tcache_once = PTHREAD_ONCE_INIT;
+#endif
+// threads are numbered as they first use a sharded pool, see _mem_shard_first
+static _Thread_local unsigned mem_thread_id = 0;
+static unsigned mem_thread_count = 0;
+// the system's page size, which POOL_MMAP pools are given back in, see
+// mem_init()
+static size_t mem_sys_page = 4096;
+// FIRST_FIT search kernel, see mem_init()
+static unsigned (*mem_scan_sizes)(const size_t *sizes, unsigned pos,
+                                  unsigned len, size_t size) = NULL;
 
 
 
@@ -84,6 +360,17 @@ static unsigned pool_store_capacity = 0;
 /*                                          */
 /********************************************/
 static alloc_status _mem_resize_pool_store();
+static alloc_status _mem_store_add(pool_mgr_pt pool_mgr);
+static void _mem_store_remove(pool_mgr_pt pool_mgr);
+static alloc_status _mem_pool_reset(pool_pt pool);
+static alloc_status _mem_pool_rewind(pool_pt pool, pool_mark_t mark);
+static void * _mem_new_alloc(pool_pt pool, size_t size);
+static alloc_status _mem_new_alloc_batch(pool_pt pool, const size_t *sizes, size_t n, void **out);
+static void * _mem_new_alloc_aligned(pool_pt pool, size_t size, size_t alignment);
+static void * _mem_realloc(pool_pt pool, void *alloc, size_t new_size);
+static alloc_status _mem_del_alloc(pool_pt pool, void* alloc);
+static alloc_status _mem_del_alloc_batch(pool_pt pool, void **allocs, size_t n);
+static void _mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
 static alloc_status
@@ -94,8 +381,92 @@ static alloc_status
         _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                 size_t size,
                                 node_pt node);
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
 static alloc_status _mem_invalidate_gap_ix(pool_mgr_pt pool_mgr);
+static unsigned _mem_find_gap_ix(pool_mgr_pt pool_mgr, size_t size);
+static unsigned _mem_find_gap_tlsf(pool_mgr_pt pool_mgr, size_t size);
+static unsigned _mem_find_gap_ff(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_resize_ff(pool_mgr_pt pool_mgr, unsigned capacity);
+static void _mem_ff_insert(pool_mgr_pt pool_mgr, size_t size, node_pt node);
+static alloc_status _mem_ff_remove(pool_mgr_pt pool_mgr, node_pt node);
+static unsigned _mem_scan_sizes(const size_t *sizes, unsigned pos, unsigned len, size_t size);
+#ifdef MEM_SCAN_X86
+static unsigned _mem_scan_sizes_sse42(const size_t *sizes, unsigned pos, unsigned len, size_t size);
+static unsigned _mem_scan_sizes_avx2(const size_t *sizes, unsigned pos, unsigned len, size_t size);
+#endif
+static node_pt _mem_resolve_handle(pool_mgr_pt pool_mgr, void *alloc);
+static int _mem_node_heap_holds(pool_mgr_pt pool_mgr, void *alloc);
+static alloc_status _mem_remote_free(pool_mgr_pt pool_mgr, void *alloc);
+#ifdef MEM_POOL_THREAD_SAFE
+static void ** _mem_remote_link(pool_mgr_pt pool_mgr, void *alloc);
+#endif
+static void _mem_remote_drain(pool_mgr_pt pool_mgr);
+static int _mem_node_claim(node_pt node);
+static void _mem_node_unclaim(node_pt node);
+static int _mem_node_cmp(const void *a, const void *b);
+static node_pt _mem_get_node(pool_mgr_pt pool_mgr);
+static void _mem_put_node(pool_mgr_pt pool_mgr, node_pt node);
+static alloc_status _mem_grow_node_heap(pool_mgr_pt pool_mgr);
+static node_pt _mem_split_node(pool_mgr_pt pool_mgr, node_pt node, size_t size);
+static void _mem_absorb_next(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_absorb_prev(pool_mgr_pt pool_mgr, node_pt node);
+static size_t _mem_buddy_block(size_t size);
+static alloc_status _mem_buddy_init(pool_mgr_pt pool_mgr);
+static void * _mem_buddy_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_buddy_free(pool_mgr_pt pool_mgr, node_pt node);
+static void * _mem_slab_alloc(pool_mgr_pt pool_mgr, size_t size);
+static slab_pt _mem_slab_find(pool_mgr_pt pool_mgr, void *alloc);
+static alloc_status _mem_slab_free(pool_mgr_pt pool_mgr, slab_pt slab, void *alloc);
+static int _mem_slab_unlive(slab_pt slab, void *alloc);
+static void _mem_slab_release(pool_mgr_pt pool_mgr, slab_pt slab);
+static void _mem_slab_drop_all(pool_mgr_pt pool_mgr);
+static unsigned _mem_slab_index(slab_pt slab, void *alloc);
+static void _mem_fixed_fill(pool_mgr_pt pool_mgr);
+static tcache_pt _mem_tcache_get(pool_mgr_pt pool_mgr);
+static void * _mem_tcache_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_tcache_free(pool_mgr_pt pool_mgr, void *alloc);
+static void _mem_tcache_flush(pool_mgr_pt pool_mgr, tcache_pt cache, unsigned size_class, unsigned n);
+static void _mem_tcache_drain(pool_mgr_pt pool_mgr);
+static void _mem_tcache_discard(pool_mgr_pt pool_mgr);
+static void _mem_tcache_release(pool_mgr_pt pool_mgr);
+#ifdef MEM_POOL_THREAD_SAFE
+static void _mem_tcache_key_init(void);
+static void _mem_tcache_exit(void *owner);
+#endif
+static pool_mgr_pt _mem_pool_init(char *new_mem, size_t size, alloc_policy policy, unsigned flags);
+static pool_pt _mem_bump_open(size_t size, unsigned flags);
+static pool_mgr_pt _mem_sharded_open(size_t size, alloc_policy policy, unsigned num_shards, unsigned capacity);
+static unsigned _mem_grow(pool_mgr_pt pool_mgr, unsigned seen, size_t need);
+static size_t _mem_grow_need(pool_mgr_pt pool_mgr, size_t size, size_t alignment);
+static unsigned _mem_shard_first(pool_mgr_pt pool_mgr);
+static void _mem_shard_sync(pool_mgr_pt pool_mgr, pool_mgr_pt shard, pool_t before);
+static pool_mgr_pt _mem_shard_owner(pool_mgr_pt pool_mgr, void *alloc);
+static void * _mem_sharded_alloc(pool_mgr_pt pool_mgr, size_t size, size_t alignment);
+static alloc_status _mem_sharded_alloc_batch(pool_mgr_pt pool_mgr, const size_t *sizes, size_t n, void **out);
+static void * _mem_sharded_realloc(pool_mgr_pt pool_mgr, void *alloc, size_t new_size);
+static alloc_status _mem_sharded_del(pool_mgr_pt pool_mgr, void *alloc);
+static alloc_status _mem_sharded_reset(pool_mgr_pt pool_mgr);
+static void _mem_sharded_inspect(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments);
+static void * _mem_bump_alloc(pool_mgr_pt pool_mgr, size_t size, size_t alignment);
+static void * _mem_bump_realloc(pool_mgr_pt pool_mgr, void *alloc, size_t new_size);
+static void * _mem_fixed_alloc(pool_mgr_pt pool_mgr, size_t size, size_t alignment);
+static alloc_status _mem_fixed_free(pool_mgr_pt pool_mgr, void *alloc);
+static void _mem_fixed_release(pool_mgr_pt pool_mgr, unsigned block);
+static unsigned _mem_fixed_block(pool_mgr_pt pool_mgr, void *alloc);
+static void _mem_fixed_inspect(pool_mgr_pt pool_mgr, pool_segment_pt segments);
+static char * _mem_alloc_pool_mem(size_t size);
+static size_t _mem_page_size(unsigned flags);
+static alloc_status _mem_file_restore(pool_mgr_pt pool_mgr, const file_record_t *records, size_t n);
+static alloc_status _mem_file_sync(pool_mgr_pt pool_mgr);
+static char * _mem_map_pool_mem(size_t size, unsigned flags);
+static void _mem_free_pool_mem(char *mem, size_t size, unsigned flags);
+static void _mem_release_pages(pool_mgr_pt pool_mgr, char *lo, char *hi, size_t min);
+static void _mem_release_gap(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_usage_add(pool_usage_t *usage, char *mem, size_t size, unsigned flags);
+static node_pt _mem_find_gap_aligned(pool_mgr_pt pool_mgr, size_t size, size_t alignment);
+static node_pt _mem_find_gap(pool_mgr_pt pool_mgr, size_t size);
+static node_pt _mem_take_gap(pool_mgr_pt pool_mgr, node_pt node, size_t size);
+static char * _mem_alloc_mem(pool_mgr_pt pool_mgr, void *alloc);
+static alloc_status _mem_resize_in_place(pool_mgr_pt pool_mgr, node_pt node, size_t new_size);
 
 
 
@@ -108,6 +479,27 @@ alloc_status mem_init() {
     // ensure that it's called only once until mem_free
     // note: holds pointers only, other functions to allocate/deallocate
     if (pool_store == NULL) {
+        // pick the widest FIRST_FIT search kernel this CPU runs, or a
+        // narrower one named by MEM_POOL_SCAN ("scalar" or "sse4.2")
+        const char *scan = getenv("MEM_POOL_SCAN");
+        int scalar = (scan != NULL && strcmp(scan, "scalar") == 0);
+        int sse42 = (scan != NULL && strcmp(scan, "sse4.2") == 0);
+        mem_scan_sizes = _mem_scan_sizes;
+#ifdef MEM_SCAN_X86
+        __builtin_cpu_init();
+        if (!scalar && !sse42 && __builtin_cpu_supports("avx2")) {
+            mem_scan_sizes = _mem_scan_sizes_avx2;
+        } else if (!scalar && __builtin_cpu_supports("sse4.2")) {
+            mem_scan_sizes = _mem_scan_sizes_sse42;
+        }
+#else
+        (void) scalar;
+        (void) sse42;
+#endif
+        long page = sysconf(_SC_PAGESIZE);
+        if (page > 0) {
+            mem_sys_page = (size_t) page;
+        }
         // allocate the pool store with initial capacity
         pool_store = (pool_mgr_pt*) calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_mgr_pt));
         pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
@@ -127,7 +519,7 @@ alloc_status mem_free() {
     }
     // make sure all pool managers have been deallocated
     // if an entry in the pool store is not null, not freed
-    for (int i = 0; i < pool_store_size; ++i) {
+    for (unsigned i = 0; i < pool_store_size; ++i) {
         if (pool_store[i] != NULL) {
             return ALLOC_NOT_FREED;
         }
@@ -143,95 +535,251 @@ alloc_status mem_free() {
 }
 
 pool_pt mem_pool_open(size_t size, alloc_policy policy) {
+    return mem_pool_open_ex(size, policy, POOL_DEFAULT);
+}
+
+pool_pt mem_pool_open_ex(size_t size, alloc_policy policy, unsigned flags) {
     // make sure there the pool store is allocated
     if (pool_store == NULL) { // no pool_store has yet been allocated
         return NULL;
     }
-    // expand the pool store, if necessary
+    // FIXED pools need a block size, see mem_pool_open_fixed()
+    if (policy == FIXED) {
+        return NULL;
+    }
+    // a cached pool is a slab pool whose objects pass through the caches
+    if (flags & POOL_TCACHE) {
+        flags |= POOL_SLAB;
+    }
+    // huge pages are mapped memory
+    if (flags & POOL_HUGE) {
+        flags |= POOL_MMAP;
+    }
+    // a BUMP pool is only the memory and an offset, with no node heap
+    // or gap index; nothing is freed one by one, so it has no slabs
+    if (policy == BUMP) {
+        if (flags & POOL_SLAB) {
+            return NULL;
+        }
+        return _mem_bump_open(size, flags);
+    }
+
+    // allocate a new memory pool, or only reserve it for POOL_MMAP
+    char * new_mem = (flags & POOL_MMAP) ? _mem_map_pool_mem(size, flags) : _mem_alloc_pool_mem(size);
+    // some error occurred, the pool was not allocated
+    if (new_mem == NULL) {
+        return NULL;
+    }
+    // allocate a new mem pool mgr for it, on error deallocate the pool
+    pool_mgr_pt new_pmgr = _mem_pool_init(new_mem, size, policy, flags);
+    if (new_pmgr == NULL) {
+        _mem_free_pool_mem(new_mem, size, flags);
+        return NULL;
+    }
 
-     alloc_status ret_status = _mem_resize_pool_store();
-     assert(ret_status == ALLOC_OK); //end program if alloc NOT ok
-     if (ret_status != ALLOC_OK) {
-         return NULL; //need to expand the pool store
-     }
+    //   link pool mgr to pool store
+    if (_mem_store_add(new_pmgr) != ALLOC_OK) {
+        mem_pool_close((pool_pt) new_pmgr);
+        return NULL;
+    }
+    // return the address of the mgr, cast to (pool_pt)
+    return (pool_pt)new_pmgr;
+}
 
-    // allocate a new mem pool mgr
+pool_pt mem_pool_open_fixed(size_t block_size, unsigned num_blocks) {
+    // make sure there the pool store is allocated
+    if (pool_store == NULL) { // no pool_store has yet been allocated
+        return NULL;
+    }
+    if (block_size == 0 || num_blocks == 0 ||
+            block_size > (size_t) -1 / num_blocks) {
+        return NULL;
+    }
+    // allocate a new mem pool mgr, the pool and the block bitmap;
+    // there is no node heap or gap index
     pool_mgr_pt new_pmgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
-    // check success, on error return null
-    assert(new_pmgr);
     if (new_pmgr == NULL) {
         return NULL;
     }
-    // allocate a new memory pool
-    void * new_mem = malloc(size);
-    // allocate mem, set all parameters
-    new_pmgr->pool.mem = new_mem;   //mem holds size bytes
-    new_pmgr->pool.policy = policy;
+    size_t size = block_size * num_blocks;
+    new_pmgr->pool.mem = _mem_alloc_pool_mem(size);
+    new_pmgr->block_map = calloc((num_blocks + 63) / 64, sizeof(uint64_t));
+    new_pmgr->remote_map = calloc((num_blocks + 63) / 64, sizeof(uint64_t));
+    if (new_pmgr->pool.mem == NULL || new_pmgr->block_map == NULL ||
+            new_pmgr->remote_map == NULL) {
+        free(new_pmgr->pool.mem);
+        free(new_pmgr->block_map);
+        free(new_pmgr->remote_map);
+        free(new_pmgr);
+        return NULL;
+    }
+    new_pmgr->pool.policy = FIXED;
     new_pmgr->pool.total_size = size;
-    new_pmgr->pool.num_allocs = 0;  // no nodes have been allocated
-    new_pmgr->pool.num_gaps = 1;    // the entire thing is a gap
     new_pmgr->pool.alloc_size = 0;  // pool has nothing allocated
-    // check success, on error deallocate mgr and return null
-    assert(new_pmgr->pool.mem);
-    // some error occurred, the pool was not allocated
-    if (new_pmgr->pool.mem == NULL) {
-        free(new_pmgr);
-        new_pmgr = NULL;
+    new_pmgr->pool.num_allocs = 0;
+    new_pmgr->pool.num_gaps = 1;    // the entire thing is a gap
+    new_pmgr->gap_ix_free = MEM_GAP_IX_NIL;
+    new_pmgr->gap_root = MEM_GAP_IX_NIL;
+    new_pmgr->ff_hole = MEM_GAP_IX_NIL;
+    new_pmgr->block_size = block_size;
+    new_pmgr->num_blocks = num_blocks;
+    new_pmgr->block_hint = 0;
+
+    // every block starts out free
+    _mem_fixed_fill(new_pmgr);
+
+    MEM_POOL_LOCK_INIT(new_pmgr);
+    //   link pool mgr to pool store
+    if (_mem_store_add(new_pmgr) != ALLOC_OK) {
+        mem_pool_close((pool_pt) new_pmgr);
         return NULL;
     }
-    // allocate a new node heap
-    node_pt new_nheap = (node_pt) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(node_t));
-    // check success, on error deallocate mgr/pool and return null
-    assert(new_nheap);
-    if (new_nheap == NULL) {
-        free(new_pmgr);
-        new_pmgr = NULL;
-        free(new_mem);
-        new_mem = NULL;
+    // return the address of the mgr, cast to (pool_pt)
+    return (pool_pt)new_pmgr;
+}
+
+pool_pt mem_pool_open_sharded(size_t size, alloc_policy policy, unsigned num_shards) {
+    // make sure there the pool store is allocated
+    if (pool_store == NULL) { // no pool_store has yet been allocated
         return NULL;
     }
-    // allocate a new gap index
-    gap_pt new_gapix = (gap_pt) calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
-    // check success, on error deallocate mgr/pool/heap and return null
-    //assert(new_gapix);
-    if (new_gapix == NULL) {
-        free(new_pmgr);
-        new_pmgr = NULL;
-        free(new_mem);
-        new_mem = NULL;
-        free(new_nheap);
-        new_nheap = NULL;
+    // every shard is a pool of general policy of at least a page, and
+    // starts on a page, as pool memory does
+    if (policy == FIXED || policy == BUMP || num_shards == 0 ||
+            size / num_shards < MEM_ALIGN_MAX) {
         return NULL;
     }
-    // assign all the pointers and update meta data:
-    new_pmgr->node_heap = new_nheap;
-    new_pmgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
-    new_pmgr->used_nodes = 1;     //just the 1 gap
-    new_pmgr->gap_ix = new_gapix;
-    new_pmgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
 
-    //   initialize top node of node heap
-    new_pmgr->node_heap[0].alloc_record.size = size;
-    new_pmgr->node_heap[0].alloc_record.mem = new_mem;
-    new_pmgr->node_heap[0].used = 1;
-    new_pmgr->node_heap[0].allocated = 0;
-    new_pmgr->node_heap[0].next = NULL;
-    new_pmgr->node_heap[0].prev = NULL;
-    //   initialize top node of gap index
-    new_pmgr->gap_ix[0].size = size;
-    new_pmgr->gap_ix[0].node = new_pmgr->node_heap;
+    pool_mgr_pt new_pmgr = _mem_sharded_open(size, policy, num_shards, num_shards);
+    if (new_pmgr == NULL) {
+        return NULL;
+    }
+    //   link pool mgr to pool store
+    if (_mem_store_add(new_pmgr) != ALLOC_OK) {
+        mem_pool_close((pool_pt) new_pmgr);
+        return NULL;
+    }
+    // return the address of the mgr, cast to (pool_pt)
+    return (pool_pt)new_pmgr;
+}
 
-    //   initialize pool mgr
+pool_pt mem_pool_open_growable(size_t size, alloc_policy policy, size_t max_size) {
+    // make sure there the pool store is allocated
+    if (pool_store == NULL) { // no pool_store has yet been allocated
+        return NULL;
+    }
+    // a growable pool is a sharded pool that starts out with one shard,
+    // its first region, and adds regions as it runs out of room
+    if (policy == FIXED || policy == BUMP || size < MEM_ALIGN_MAX || max_size < size) {
+        return NULL;
+    }
+
+    pool_mgr_pt new_pmgr = _mem_sharded_open(size, policy, 1, MEM_MAX_REGIONS);
+    if (new_pmgr == NULL) {
+        return NULL;
+    }
+    new_pmgr->max_size = max_size;
     //   link pool mgr to pool store
-    // find the first empty position in the pool_store
-    // and link the new pool mgr to that location
-    for(int i = 0; i < pool_store_size; ++i) {
-        if (pool_store[i] == NULL) {
-            pool_store[i] = new_pmgr;
-            ++pool_store_size;
-            break;
+    if (_mem_store_add(new_pmgr) != ALLOC_OK) {
+        mem_pool_close((pool_pt) new_pmgr);
+        return NULL;
+    }
+    // return the address of the mgr, cast to (pool_pt)
+    return (pool_pt)new_pmgr;
+}
+
+pool_pt mem_pool_open_file(const char *path, size_t size, alloc_policy policy) {
+    // make sure there the pool store is allocated
+    if (pool_store == NULL) { // no pool_store has yet been allocated
+        return NULL;
+    }
+    // the allocations are brought back by making them again in address
+    // order from a single gap, which puts them where they were for the
+    // policies that place allocations in gaps only
+    if (path == NULL || policy == BUDDY || policy == FIXED || policy == BUMP) {
+        return NULL;
+    }
+    size_t rounded = (size + MEM_ALIGN_MAX - 1) & ~(MEM_ALIGN_MAX - 1);
+    if (size == 0 || rounded < size) {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    file_header_t header;
+    file_record_t *records = NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size == 0) {
+        // a new file holds an empty pool
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MEM_FILE_MAGIC, sizeof(header.magic));
+        header.size = size;
+        header.policy = (uint32_t) policy;
+        header.table = MEM_FILE_DATA + rounded;
+        if (ftruncate(fd, (off_t) (MEM_FILE_DATA + rounded)) != 0 ||
+                pwrite(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+            close(fd);
+            return NULL;
+        }
+    } else {
+        // an existing one must hold a pool of this size and policy
+        if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+                memcmp(header.magic, MEM_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+                header.size != size || header.policy != (uint32_t) policy ||
+                header.table < MEM_FILE_DATA + rounded || header.table > (uint64_t) st.st_size ||
+                header.num_records > ((uint64_t) st.st_size - header.table) / sizeof(file_record_t)) {
+            close(fd);
+            return NULL;
+        }
+        size_t bytes = header.num_records * sizeof(file_record_t);
+        records = malloc((bytes > 0) ? bytes : 1);
+        if (records == NULL ||
+                pread(fd, records, bytes, (off_t) header.table) != (ssize_t) bytes) {
+            free(records);
+            close(fd);
+            return NULL;
         }
     }
+
+    // map the pool memory, shared so that writes go to the file
+    char *new_mem = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t) MEM_FILE_DATA);
+    if (new_mem == MAP_FAILED) {
+        free(records);
+        close(fd);
+        return NULL;
+    }
+    pool_mgr_pt new_pmgr = _mem_pool_init(new_mem, size, policy, POOL_DEFAULT);
+    if (new_pmgr == NULL) {
+        munmap(new_mem, rounded);
+        free(records);
+        close(fd);
+        return NULL;
+    }
+    new_pmgr->flags |= MEM_POOL_FILE;
+    new_pmgr->file_fd = fd;
+
+    // a file that does not describe a pool is left as it is
+    alloc_status status = _mem_file_restore(new_pmgr, records, header.num_records);
+    free(records);
+    if (status != ALLOC_OK) {
+        new_pmgr->flags &= ~MEM_POOL_FILE;
+        new_pmgr->flags |= POOL_MMAP;
+        close(fd);
+        mem_pool_close_force((pool_pt) new_pmgr);
+        return NULL;
+    }
+
+    //   link pool mgr to pool store
+    if (_mem_store_add(new_pmgr) != ALLOC_OK) {
+        mem_pool_close((pool_pt) new_pmgr);
+        return NULL;
+    }
     // return the address of the mgr, cast to (pool_pt)
     return (pool_pt)new_pmgr;
 }
@@ -241,491 +789,3557 @@ alloc_status mem_pool_close(pool_pt pool) {
     // possible because pool is at the top of the pool_mgr_t structure
     pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
     
+    // frees left by other threads are done first, and objects held in the
+    // threads' caches go back to their slabs
+    if (new_pmgr != NULL) {
+        _mem_remote_drain(new_pmgr);
+        for (unsigned i = 0; i < new_pmgr->num_shards; ++i) {
+            pool_mgr_pt shard = new_pmgr->shards[i];
+            pool_t before = shard->pool;
+            _mem_remote_drain(shard);
+            _mem_shard_sync(new_pmgr, shard, before);
+        }
+        // an exiting thread flushes its cache under the store lock
+        MEM_STORE_LOCK();
+        _mem_tcache_drain(new_pmgr);
+        MEM_STORE_UNLOCK();
+    }
+    // a file pool keeps its allocations: they are written to the file,
+    // and only this process lets go of the pool
+    int persistent = (new_pmgr != NULL && (new_pmgr->flags & MEM_POOL_FILE));
+    if (persistent && _mem_file_sync(new_pmgr) != ALLOC_OK) {
+        return ALLOC_FAIL;
+    }
     // check if this pool is allocated
     // check if it has zero allocations
+    if (new_pmgr == NULL || (pool->num_allocs >= 1 && !persistent)) {
+        return ALLOC_NOT_FREED;
+    }
+    // a sharded pool closes its shards first, all of them or none
+    for (unsigned i = 0; i < new_pmgr->num_shards; ++i) {
+        if (new_pmgr->shards[i]->pool.num_allocs >= 1) {
+            return ALLOC_NOT_FREED;
+        }
+    }
+    for (unsigned i = 0; i < new_pmgr->num_shards; ++i) {
+        // the regions a growable pool added own their memory
+        char *region_mem = (i > 0 && new_pmgr->max_size != 0) ? new_pmgr->shards[i]->pool.mem : NULL;
+        mem_pool_close(&new_pmgr->shards[i]->pool);
+        free(region_mem);
+    }
+    if (new_pmgr->shards != NULL) {
+        free(new_pmgr->shards);
+        new_pmgr->shards = NULL;
+        new_pmgr->num_shards = 0;
+        pool->num_gaps = 1;
+    }
+    // with no allocations left every slab is empty, give them back
+    for (unsigned i = 0; i < MEM_SLAB_NUM_CLASSES; ++i) {
+        while (new_pmgr->slab_partial[i] != NULL) {
+            _mem_slab_release(new_pmgr, new_pmgr->slab_partial[i]);
+        }
+    }
     // check if pool has only one gap
-    if (
-       (new_pmgr == NULL) ||
-       (pool->num_gaps > 1) ||
-       (pool->num_gaps == 0) ||
-       pool->num_allocs >= 1) {
+    // (an empty BUDDY pool is one gap per initial block)
+    if (!persistent && ((pool->num_gaps > 1 && pool->policy != BUDDY) ||
+                        (pool->num_gaps == 0))) {
         return ALLOC_NOT_FREED;
     }
-    // free memory pool
-    free(new_pmgr->pool.mem);
+    // free memory pool, unless it is a slice of a sharded pool
+    if (new_pmgr->sharded == NULL) {
+        _mem_free_pool_mem(new_pmgr->pool.mem, pool->total_size, new_pmgr->flags);
+    }
     new_pmgr->pool.mem = NULL;
+    if (persistent) {
+        close(new_pmgr->file_fd);
+    }
 
     // free node heap
-    free(new_pmgr->node_heap);
-    new_pmgr->node_heap = NULL;
+    for (unsigned i = 0; i < new_pmgr->num_chunks; ++i) {
+        free(new_pmgr->node_heap[i].nodes);
+        new_pmgr->node_heap[i].nodes = NULL;
+    }
+    new_pmgr->num_chunks = 0;
 
     // free gap index
     free(new_pmgr->gap_ix);
     new_pmgr->gap_ix = NULL;
+    free(new_pmgr->ff_mem);
+    new_pmgr->ff_mem = NULL;
+    free(new_pmgr->ff_size);
+    new_pmgr->ff_size = NULL;
+    free(new_pmgr->ff_node);
+    new_pmgr->ff_node = NULL;
 
-    // find mgr in pool store and set to null
-    for(int i = 0; i < pool_store_size; ++i) {
-        if (pool_store[i] == new_pmgr) {
-            pool_store[i] = NULL;
-            break;
-        }
+    // free slab map
+    free(new_pmgr->slab_map);
+    new_pmgr->slab_map = NULL;
+
+    // free block bitmaps
+    free(new_pmgr->block_map);
+    new_pmgr->block_map = NULL;
+    free(new_pmgr->remote_map);
+    new_pmgr->remote_map = NULL;
+
+    // free the threads' caches, empty by now
+    _mem_tcache_release(new_pmgr);
+
+    // find mgr in pool store and set to null (shards are not in it)
+    if (new_pmgr->sharded == NULL) {
+        _mem_store_remove(new_pmgr);
     }
-    // note: don't decrement pool_store_size, because it only grows
     // free mgr
+    MEM_POOL_LOCK_DESTROY(new_pmgr);
     free(new_pmgr);
     new_pmgr = NULL;
     return ALLOC_OK;
 }
 
-void * mem_new_alloc(pool_pt pool, size_t size) {
-    
+alloc_status mem_pool_close_force(pool_pt pool) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
-    pool_mgr_pt new_pmgr = (pool_mgr_pt) (pool);
-    
-    // check if any gaps, return null if none
-    if (new_pmgr->pool.num_gaps == 0) {
-        return NULL;
-    }
-    // expand heap node, if necessary, quit on error
-    //TODO see if this works
-    alloc_status result =_mem_resize_node_heap(new_pmgr); // observe gap index here
-    
-    assert(result == ALLOC_OK);
-    // check used nodes fewer than total nodes, quit on error
-    if (new_pmgr->used_nodes > new_pmgr->total_nodes) {
-        return NULL;
-    }
-    
-    node_pt new_alloc = NULL;
-    if (pool->policy == FIRST_FIT) {
-        
-        // assumes node_heap[0] is the head ptr
-        new_alloc = new_pmgr->node_heap;
-        for (int i = 0; i < new_pmgr->total_nodes; ++i) {
-            
-            // Used: 1, Allocated: 0 indicates a gap
-            // looking for gap who's size is > than our needed size
-            if (new_alloc->used == 1 && new_alloc->allocated == 0
-                && size <= new_alloc->alloc_record.size) { // found gap
-                // use new_alloc->allocated to signal success below
-                new_alloc->allocated = 1;
-                break;
-            }
-            
-            new_alloc = new_alloc->next;
-            if (new_alloc == NULL) {
-                return NULL;
-            }
-        }
-        
-    } else if (pool->policy == BEST_FIT) {
-        
-        // gaps will be sorted according to size available
-        for (int i = 0; i < pool->num_gaps; ++i) {                  //[0] gets cleared and gap goes go [1]
-            if (size <= new_pmgr->gap_ix[i].size) { // found gap
-                new_alloc = new_pmgr->gap_ix[i].node;
-                // use new_alloc->allocated to signal success below
-                new_alloc->allocated = 1;
-                break;
-            }
-        }
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+
+    if (new_pmgr == NULL) {
+        return ALLOC_NOT_FREED;
     }
-    
-    // TODO assert
-    // if we exit all the way without finding an unused node, we will need a bigger node
-    // heap. that should be taken care of above, so I should also add an assert here
-    
-    // on resizing, new_alloc is NULL and we return NULL, but the actual
-    // linkage seems to work?
-    if (new_alloc == NULL || !new_alloc->allocated) { //the node was not found
-        return NULL;
+
+    // the allocations go away with the memory, so only the slab records,
+    // which live outside the pool, need to be freed one by one
+    _mem_tcache_discard(new_pmgr);
+    _mem_slab_drop_all(new_pmgr);
+    new_pmgr->remote_frees = NULL;
+    pool->num_allocs = 0;
+    pool->alloc_size = 0;
+    pool->num_gaps = 1;
+    // and so do those of a sharded pool's shards
+    for (unsigned i = 0; i < new_pmgr->num_shards; ++i) {
+        pool_mgr_pt shard = new_pmgr->shards[i];
+        _mem_slab_drop_all(shard);
+        shard->remote_frees = NULL;
+        shard->pool.num_allocs = 0;
+        shard->pool.alloc_size = 0;
+        shard->pool.num_gaps = 1;
     }
-    
-    // At this point, new_alloc is a gap, and
-    // new_alloc->alloc_record.size; is the size of the gap
-    
-    // update metadata (num_allocs, alloc_size)
-    pool->num_allocs += 1;
-    pool->alloc_size += size;
-    
-    size_t remaining_gap = new_alloc->alloc_record.size - size;
-    _mem_remove_from_gap_ix(new_pmgr, new_alloc->alloc_record.size, new_alloc);
-    
-    // convert gap_node to an allocation node of given size
-    new_alloc->alloc_record.size = size;
-    new_alloc->alloc_record.mem = pool->mem + pool->alloc_size;
-    
-    if (remaining_gap) {
-        
-        node_pt new_gap = NULL;
-        for (int i = 0; i < new_pmgr->total_nodes; ++i) {
-            
-            if (!new_pmgr->node_heap[i].used) {
-                
-                // found an unused node in the node heap
-                new_gap = &new_pmgr->node_heap[i];
-                new_gap->used = 1;
-                new_gap->alloc_record.mem = NULL;
-                new_gap->alloc_record.size = remaining_gap;
-                new_gap->allocated = 0;
-                
-                if (new_alloc->next != NULL) {
-                    new_alloc->next->prev = new_gap;
-                }
-                new_gap->next = new_alloc->next;
-                new_alloc->next = new_gap;
-                new_gap->prev = new_alloc;
-                new_pmgr->used_nodes += 1;
-                break;
-            }
-        }
-        
-        alloc_status status = _mem_add_to_gap_ix(new_pmgr, remaining_gap, new_gap);
-        
-        if (status == ALLOC_FAIL) {
-            return NULL;
-        }
+
+    return mem_pool_close(pool);
+}
+
+alloc_status mem_pool_reset(pool_pt pool) {
+    // a sharded pool resets its shards, each under its own lock
+    if (pool != NULL && ((pool_mgr_pt) pool)->shards != NULL) {
+        return _mem_sharded_reset((pool_mgr_pt) pool);
     }
-    
-    return (alloc_pt) new_alloc;
+    MEM_POOL_LOCK(pool);
+    alloc_status status = _mem_pool_reset(pool);
+    MEM_POOL_UNLOCK(pool);
+    return status;
 }
 
-alloc_status mem_del_alloc(pool_pt pool, void* alloc) {
-    
+static alloc_status _mem_pool_reset(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
-    node_pt node_handle = (node_pt) alloc;
-    
-    // find the node to delete in the node heap
-    unsigned del_index = 0;
-    while (del_index < new_pmgr->total_nodes) { //addresses of sizes works..?
-        if (new_pmgr->node_heap[del_index].alloc_record.size ==
-                node_handle->alloc_record.size) {
-            //break;
-        }
-        if (&new_pmgr->node_heap[del_index].alloc_record.mem == &node_handle->alloc_record.mem) {
-            break;
-        }
-        ++del_index;
-    }
-    
-    // make sure it's found
-    if (del_index == new_pmgr->total_nodes) {
+
+    if (new_pmgr == NULL) {
         return ALLOC_FAIL;
     }
-    
-    // Otherwise handle points to old node?
-    node_handle = &new_pmgr->node_heap[del_index];
-    
-    // convert to gap node
-    // allocated = 0 indicates a gap node
-    node_handle->allocated = 0; //node_handle points to old node?
-    
+
     // update metadata (num_allocs, alloc_size)
-    --pool->num_allocs;
-    pool->alloc_size -= node_handle->alloc_record.size;
-    
-    // if the next node in the list is also a gap, merge into node handle
-    if ((node_handle->next != NULL) &&
-        (node_handle->next->allocated == 0)) {
-        
-        _mem_remove_from_gap_ix(new_pmgr,
-            node_handle->next->alloc_record.size,
-            node_handle->next);
-        
-        // add the sizes
-        // update node as unused
-        // update metadata (used nodes)
-        node_handle->alloc_record.size += node_handle->next->alloc_record.size;
-        node_handle->next->used = 0;
-        --new_pmgr->used_nodes;
-        
-        // update linked list:
-        // IF next node has a continuing node, give
-        // THAT node a new prev. We are merging the
-        // node_handle->next INTO node_handle
-       
-        //node->next->next equals 0x640, a weird non-null address
-        if (node_handle->next->next) { //seg fault?
-            node_handle->next->next->prev = node_handle;
-        }
-        node_pt tmp = node_handle->next;
-        node_handle->next = node_handle->next->next;
-        tmp->next = NULL;
-        tmp->prev = NULL;
-        tmp->alloc_record.size = 0;
+    pool->num_allocs = 0;
+    pool->alloc_size = 0;
+
+    // frees left by other threads are moot
+    new_pmgr->remote_frees = NULL;
+
+    // the whole of a mapped pool goes back to the system
+    if (new_pmgr->flags & POOL_MMAP) {
+        _mem_release_pages(new_pmgr, pool->mem, pool->mem + pool->total_size, 0);
     }
-    
-    // if the prev node in the list is also a gap, merge into node handle
-    if ((node_handle->prev != NULL) &&
-        (node_handle->prev->allocated == 0)) {
-        
-        alloc_status status = _mem_remove_from_gap_ix(new_pmgr,
-            node_handle->prev->alloc_record.size,
-            node_handle->prev);
-        
-        // add the sizes
-        // update node as unused
-        // update metadata (used nodes)
-        node_handle->alloc_record.size += node_handle->prev->alloc_record.size;
-        node_handle->prev->used = 0;
-        --new_pmgr->used_nodes;
-        
-        // update linked list:
-        // IF prev node has a continuing node, give
-        // THAT node a new next. We are merging the
-        // node_handle->prev INTO node_handle
-        if (node_handle->prev->prev) {
-            node_handle->prev->prev->next = node_handle;
-        }
-        node_pt tmp = node_handle->prev;
-        node_handle->prev = node_handle->prev->prev;
-        tmp->prev = NULL;
-        tmp->next = NULL;
-        tmp->alloc_record.size = 0;
+
+    // a FIXED pool only has its bitmap to refill
+    if (pool->policy == FIXED) {
+        _mem_fixed_fill(new_pmgr);
+        pool->num_gaps = 1;
+        new_pmgr->block_hint = 0;
+        return ALLOC_OK;
     }
+
+    // a BUMP pool only has its offset to clear
+    if (pool->policy == BUMP) {
+        new_pmgr->bump_top = 0;
+        new_pmgr->bump_last = MEM_BUMP_NONE;
+        pool->num_gaps = 1;
+        return ALLOC_OK;
+    }
+
+    // cached objects were allocations too, and are gone with their slabs
+    _mem_tcache_discard(new_pmgr);
+    _mem_slab_drop_all(new_pmgr);
+
+    // keep only the first node heap chunk and clear it, so that handles
+    // from before the reset no longer resolve
+    for (unsigned i = 1; i < new_pmgr->num_chunks; ++i) {
+        free(new_pmgr->node_heap[i].nodes);
+        new_pmgr->node_heap[i].nodes = NULL;
+    }
+    node_pt nodes = new_pmgr->node_heap[0].nodes;
+    memset(nodes, 0, new_pmgr->node_heap[0].capacity * sizeof(node_t));
+    new_pmgr->num_chunks = 1;
+    new_pmgr->total_nodes = new_pmgr->node_heap[0].capacity;
+    new_pmgr->used_nodes = 1;     //just the 1 gap
+    new_pmgr->node_heap_top = 1;
+    new_pmgr->free_nodes = NULL;
+
+    //   the top node of the node heap is the whole pool again
+    new_pmgr->head = &nodes[0];
+    new_pmgr->head->alloc_record.size = pool->total_size;
+    new_pmgr->head->alloc_record.mem = pool->mem;
+    new_pmgr->head->used = 1;
+    __atomic_store_n(&new_pmgr->head->allocated, 0, __ATOMIC_RELAXED);
+    new_pmgr->rover = new_pmgr->head;
+
+    //   and the only entry of the gap index
+    _mem_invalidate_gap_ix(new_pmgr);
+    _mem_add_to_gap_ix(new_pmgr, pool->total_size, new_pmgr->head);
+
+    //   a BUDDY pool starts out as its largest blocks
+    if (pool->policy == BUDDY) {
+        return _mem_buddy_init(new_pmgr);
+    }
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_flush_cache(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+
+    if (new_pmgr == NULL) {
+        return ALLOC_FAIL;
+    }
+    if (!(new_pmgr->flags & POOL_TCACHE)) {
+        return ALLOC_OK;
+    }
+
+    // give back every object in the calling thread's cache
+    tcache_pt cache = _mem_tcache_get(new_pmgr);
+    if (cache == NULL) {
+        return ALLOC_FAIL;
+    }
+    for (unsigned i = 0; i < MEM_SLAB_NUM_CLASSES; ++i) {
+        _mem_tcache_flush(new_pmgr, cache, i, cache->count[i]);
+    }
+    return ALLOC_OK;
+}
+
+pool_mark_t mem_pool_mark(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+
+    MEM_POOL_LOCK(pool);
+    pool_mark_t mark = { new_pmgr->bump_top, pool->num_allocs };
+    MEM_POOL_UNLOCK(pool);
+    return mark;
+}
+
+alloc_status mem_pool_rewind(pool_pt pool, pool_mark_t mark) {
+    MEM_POOL_LOCK(pool);
+    alloc_status status = _mem_pool_rewind(pool, mark);
+    MEM_POOL_UNLOCK(pool);
+    return status;
+}
+
+static alloc_status _mem_pool_rewind(pool_pt pool, pool_mark_t mark) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+
+    // only a BUMP pool can go back, and only to where it has been
+    if (pool->policy != BUMP || mark.offset > new_pmgr->bump_top ||
+            mark.num_allocs > pool->num_allocs) {
+        return ALLOC_FAIL;
+    }
+
+    // everything allocated since the mark is discarded, and the pages
+    // above it of a mapped pool go back to the system
+    if (new_pmgr->flags & POOL_MMAP) {
+        size_t page = _mem_page_size(new_pmgr->flags);
+        size_t top = (new_pmgr->bump_top + page - 1) & ~(page - 1);
+        _mem_release_pages(new_pmgr, pool->mem + mark.offset, pool->mem + top, MEM_RELEASE_MIN);
+    }
+    new_pmgr->bump_top = mark.offset;
+    new_pmgr->bump_last = MEM_BUMP_NONE;
+
+    // update metadata (num_allocs, alloc_size, num_gaps)
+    pool->num_allocs = mark.num_allocs;
+    pool->alloc_size = mark.offset;
+    pool->num_gaps = (mark.offset < pool->total_size);
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_purge(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+
+    if (new_pmgr == NULL) {
+        return ALLOC_FAIL;
+    }
+    if (!(new_pmgr->flags & POOL_MMAP)) {
+        return ALLOC_OK;
+    }
+
+    // give back the whole pages of every gap, however few
+    MEM_POOL_LOCK(pool);
+    _mem_remote_drain(new_pmgr);
+    if (pool->policy == BUMP) {
+        _mem_release_pages(new_pmgr, pool->mem + new_pmgr->bump_top, pool->mem + pool->total_size, 0);
+    } else {
+        for (node_pt node = new_pmgr->head; node != NULL; node = node->next) {
+            if (!node->allocated) {
+                _mem_release_pages(new_pmgr, node->alloc_record.mem,
+                                   node->alloc_record.mem + node->alloc_record.size, 0);
+                node->dirty = 0;
+            }
+        }
+    }
+    MEM_POOL_UNLOCK(pool);
+    return ALLOC_OK;
+}
+
+pool_usage_t mem_pool_usage(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+    pool_usage_t usage = { 0, 0 };
+
+    if (new_pmgr == NULL) {
+        return usage;
+    }
+    // the regions of a growable pool are apart, the shards of a sharded
+    // pool are slices of its memory
+    if (new_pmgr->max_size != 0) {
+        unsigned num_shards = __atomic_load_n(&new_pmgr->num_shards, __ATOMIC_ACQUIRE);
+        for (unsigned i = 0; i < num_shards; ++i) {
+            pool_pt region = &new_pmgr->shards[i]->pool;
+            _mem_usage_add(&usage, region->mem, region->total_size, new_pmgr->flags);
+        }
+    } else {
+        _mem_usage_add(&usage, pool->mem, pool->total_size, new_pmgr->flags);
+    }
+    return usage;
+}
+
+alloc_status mem_pool_sync(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+
+    if (new_pmgr == NULL || !(new_pmgr->flags & MEM_POOL_FILE)) {
+        return ALLOC_FAIL;
+    }
+    MEM_POOL_LOCK(pool);
+    _mem_remote_drain(new_pmgr);
+    alloc_status status = _mem_file_sync(new_pmgr);
+    MEM_POOL_UNLOCK(pool);
+    return status;
+}
+
+void * mem_new_alloc(pool_pt pool, size_t size) {
+    // a sharded pool allocates from the calling thread's shard first
+    if (((pool_mgr_pt) pool)->shards != NULL) {
+        return _mem_sharded_alloc((pool_mgr_pt) pool, size, 0);
+    }
+    // small allocations of a cached pool come from the thread's cache,
+    // which takes the lock only to refill
+    if ((((pool_mgr_pt) pool)->flags & POOL_TCACHE) && size <= MEM_SLAB_MAX_SIZE) {
+        void *obj = _mem_tcache_alloc((pool_mgr_pt) pool, size);
+        if (obj != NULL) {
+            return obj;
+        }
+    }
+    MEM_POOL_LOCK(pool);
+    _mem_remote_drain((pool_mgr_pt) pool);
+    void *alloc = _mem_new_alloc(pool, size);
+    MEM_POOL_UNLOCK(pool);
+    return alloc;
+}
+
+static void * _mem_new_alloc(pool_pt pool, size_t size) {
     
-    alloc_status status = _mem_add_to_gap_ix(new_pmgr, node_handle->alloc_record.size, node_handle);
-    
-    if (status == ALLOC_FAIL) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) (pool);
+
+    // bump allocations just advance the offset
+    if (pool->policy == BUMP) {
+        return _mem_bump_alloc(new_pmgr, size, 1);
+    }
+
+    // fixed-size blocks are taken straight from the bitmap
+    if (pool->policy == FIXED) {
+        return _mem_fixed_alloc(new_pmgr, size, 1);
+    }
+
+    // small allocations come from a slab when the pool has them; if no
+    // slab can be had they fall through to the regular allocator
+    if (new_pmgr->slab_map != NULL && size <= MEM_SLAB_MAX_SIZE) {
+        void *obj = _mem_slab_alloc(new_pmgr, size);
+        if (obj != NULL) {
+            return obj;
+        }
+    }
+    
+    // check if any gaps, return null if none
+    if (new_pmgr->pool.num_gaps == 0) {
+        return NULL;
+    }
+    // expand heap node, if necessary, quit on error
+    alloc_status result = _mem_resize_node_heap(new_pmgr);
+    if (result != ALLOC_OK) {
+        return NULL;
+    }
+    // check used nodes fewer than total nodes, quit on error
+    if (new_pmgr->used_nodes >= new_pmgr->total_nodes) {
+        return NULL;
+    }
+
+    // buddy blocks are split and merged by their own rules
+    if (pool->policy == BUDDY) {
+        return _mem_buddy_alloc(new_pmgr, size);
+    }
+    
+    node_pt new_alloc = _mem_find_gap(new_pmgr, size);
+    if (new_alloc == NULL) { //the node was not found
+        return NULL;
+    }
+    if (_mem_take_gap(new_pmgr, new_alloc, size) == NULL) {
+        return NULL;
+    }
+
+    // update metadata (num_allocs, alloc_size)
+    pool->num_allocs += 1;
+    pool->alloc_size += size;
+
+    return (alloc_pt) new_alloc;
+}
+
+alloc_status mem_new_alloc_batch(pool_pt pool, const size_t *sizes, size_t n, void **out) {
+    if (((pool_mgr_pt) pool)->shards != NULL) {
+        return _mem_sharded_alloc_batch((pool_mgr_pt) pool, sizes, n, out);
+    }
+    MEM_POOL_LOCK(pool);
+    _mem_remote_drain((pool_mgr_pt) pool);
+    alloc_status status = _mem_new_alloc_batch(pool, sizes, n, out);
+    MEM_POOL_UNLOCK(pool);
+    return status;
+}
+
+static alloc_status _mem_new_alloc_batch(pool_pt pool, const size_t *sizes, size_t n, void **out) {
+
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) (pool);
+
+    // every request takes at most one node, for the rest of its gap, so
+    // the node heap is grown once for the whole batch
+    if (pool->policy != FIXED && pool->policy != BUMP) {
+        while (new_pmgr->total_nodes - new_pmgr->used_nodes < n) {
+            if (_mem_grow_node_heap(new_pmgr) != ALLOC_OK) {
+                return ALLOC_FAIL;
+            }
+        }
+    }
+
+    // a BUMP pool frees nothing, so it goes back to here if one fails
+    pool_mark_t mark = { new_pmgr->bump_top, pool->num_allocs };
+    size_t bump_last = new_pmgr->bump_last;
+
+    // serve the requests in order, as that many mem_new_alloc calls would,
+    // adding up the metadata of the plain allocations as we go
+    unsigned num_allocs = 0;
+    size_t alloc_size = 0;
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        size_t size = sizes[i];
+        if (pool->policy == FIXED) {
+            out[i] = _mem_fixed_alloc(new_pmgr, size, 1);
+        } else if (pool->policy == BUMP) {
+            out[i] = _mem_bump_alloc(new_pmgr, size, 1);
+        } else if (new_pmgr->slab_map != NULL && size <= MEM_SLAB_MAX_SIZE &&
+                (out[i] = _mem_slab_alloc(new_pmgr, size)) != NULL) {
+            // a slab object
+        } else if (pool->policy == BUDDY) {
+            out[i] = _mem_buddy_alloc(new_pmgr, size);
+        } else {
+            node_pt node = _mem_find_gap(new_pmgr, size);
+            out[i] = (node != NULL) ? _mem_take_gap(new_pmgr, node, size) : NULL;
+            if (out[i] != NULL) {
+                ++num_allocs;
+                alloc_size += size;
+            }
+        }
+        if (out[i] == NULL) {
+            break;
+        }
+    }
+
+    // update metadata (num_allocs, alloc_size)
+    pool->num_allocs += num_allocs;
+    pool->alloc_size += alloc_size;
+
+    // all or nothing: give back what was allocated if one request failed
+    if (i < n) {
+        size_t j;
+        if (pool->policy == BUMP) {
+            _mem_pool_rewind(pool, mark);
+            new_pmgr->bump_last = bump_last;
+        } else {
+            for (j = 0; j < i; ++j) {
+                _mem_del_alloc(pool, out[j]);
+            }
+        }
+        for (j = 0; j < n; ++j) {
+            out[j] = NULL;
+        }
+        return ALLOC_FAIL;
+    }
+    return ALLOC_OK;
+}
+
+void * mem_new_alloc_aligned(pool_pt pool, size_t size, size_t alignment) {
+    if (((pool_mgr_pt) pool)->shards != NULL) {
+        return _mem_sharded_alloc((pool_mgr_pt) pool, size, alignment);
+    }
+    MEM_POOL_LOCK(pool);
+    _mem_remote_drain((pool_mgr_pt) pool);
+    void *alloc = _mem_new_alloc_aligned(pool, size, alignment);
+    MEM_POOL_UNLOCK(pool);
+    return alloc;
+}
+
+static void * _mem_new_alloc_aligned(pool_pt pool, size_t size, size_t alignment) {
+
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) (pool);
+
+    // alignment is a power of two, from 8 bytes up to a page
+    if (alignment < MEM_ALIGN_MIN || alignment > MEM_ALIGN_MAX ||
+            (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+
+    // fixed-size blocks are taken straight from the bitmap
+    if (pool->policy == FIXED) {
+        return _mem_fixed_alloc(new_pmgr, size, alignment);
+    }
+
+    // bump allocations skip ahead to the aligned address
+    if (pool->policy == BUMP) {
+        return _mem_bump_alloc(new_pmgr, size, alignment);
+    }
+
+    // check if any gaps, return null if none
+    if (new_pmgr->pool.num_gaps == 0) {
+        return NULL;
+    }
+    // expand heap node, if necessary, quit on error; an aligned
+    // allocation may split its gap twice, so make sure of two nodes
+    if (_mem_resize_node_heap(new_pmgr) != ALLOC_OK ||
+            new_pmgr->total_nodes - new_pmgr->used_nodes < 2) {
+        return NULL;
+    }
+
+    // a buddy block is aligned to its size, so a block at least as large
+    // as the alignment will do
+    if (pool->policy == BUDDY) {
+        return _mem_buddy_alloc(new_pmgr, (size < alignment) ? alignment : size);
+    }
+
+    node_pt new_alloc = _mem_find_gap_aligned(new_pmgr, size, alignment);
+    if (new_alloc == NULL) {
+        return NULL;
+    }
+
+    // the slack ahead of the aligned address stays behind as a gap
+    size_t pad = (size_t) (-(uintptr_t) new_alloc->alloc_record.mem & (alignment - 1));
+    if (pad > 0) {
+        if (_mem_remove_from_gap_ix(new_pmgr, new_alloc->alloc_record.size, new_alloc) != ALLOC_OK) {
+            return NULL;
+        }
+        node_pt aligned = _mem_split_node(new_pmgr, new_alloc, pad);
+        _mem_add_to_gap_ix(new_pmgr, new_alloc->alloc_record.size, new_alloc);
+        if (aligned == NULL) {
+            return NULL;
+        }
+        new_alloc = aligned;
+    }
+
+    if (_mem_take_gap(new_pmgr, new_alloc, size) == NULL) {
+        return NULL;
+    }
+
+    // update metadata (num_allocs, alloc_size)
+    pool->num_allocs += 1;
+    pool->alloc_size += size;
+
+    return (alloc_pt) new_alloc;
+}
+
+void * mem_realloc(pool_pt pool, void *alloc, size_t new_size) {
+    if (((pool_mgr_pt) pool)->shards != NULL) {
+        return _mem_sharded_realloc((pool_mgr_pt) pool, alloc, new_size);
+    }
+    MEM_POOL_LOCK(pool);
+    _mem_remote_drain((pool_mgr_pt) pool);
+    void *new_alloc = _mem_realloc(pool, alloc, new_size);
+    MEM_POOL_UNLOCK(pool);
+    return new_alloc;
+}
+
+static void * _mem_realloc(pool_pt pool, void *alloc, size_t new_size) {
+
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+
+    // like realloc(), no allocation means a new one
+    if (alloc == NULL) {
+        return _mem_new_alloc(pool, new_size);
+    }
+
+    // a fixed-size block only ever holds up to the block size
+    if (pool->policy == FIXED) {
+        if (_mem_fixed_block(new_pmgr, alloc) == new_pmgr->num_blocks ||
+                new_size > new_pmgr->block_size) {
+            return NULL;
+        }
+        return alloc;
+    }
+
+    // only the last bump allocation can be resized in place
+    if (pool->policy == BUMP) {
+        return _mem_bump_realloc(new_pmgr, alloc, new_size);
+    }
+
+    // find out how much there is to keep, resizing in place if possible
+    size_t old_size;
+    if (new_pmgr->slab_map != NULL &&
+            (char *) alloc >= pool->mem &&
+            (char *) alloc < pool->mem + pool->total_size) {
+        // a slab object stays put while the new size fits the object
+        slab_pt slab = _mem_slab_find(new_pmgr, alloc);
+        unsigned index = (slab != NULL) ? _mem_slab_index(slab, alloc) : MEM_SLAB_MAX_OBJS;
+        if (index == MEM_SLAB_MAX_OBJS ||
+                ((new_pmgr->flags & POOL_TCACHE) &&
+                 !(__atomic_load_n(&slab->live_map[index / 64], __ATOMIC_RELAXED) &
+                   ((uint64_t) 1 << (index % 64))))) {
+            return NULL;
+        }
+        old_size = slab->req_size[index];
+        if (new_size <= slab->obj_size) {
+            // objects of a cached pool are counted at their class size
+            if (!(new_pmgr->flags & POOL_TCACHE)) {
+                pool->alloc_size = pool->alloc_size - old_size + new_size;
+                slab->req_size[index] = (unsigned short) new_size;
+            }
+            return alloc;
+        }
+    } else {
+        node_pt node = _mem_resolve_handle(new_pmgr, alloc);
+        if (node == NULL) {
+            return NULL;
+        }
+        old_size = node->alloc_record.size;
+        if (pool->policy == BUDDY) {
+            // a buddy block stays put while the new size needs the same block
+            if (_mem_buddy_block(new_size) == old_size) {
+                return alloc;
+            }
+        } else if (_mem_resize_in_place(new_pmgr, node, new_size) == ALLOC_OK) {
+            return alloc;
+        }
+    }
+
+    // otherwise allocate, copy and free
+    void *new_alloc = _mem_new_alloc(pool, new_size);
+    if (new_alloc == NULL) {
+        return NULL;
+    }
+    memcpy(_mem_alloc_mem(new_pmgr, new_alloc), _mem_alloc_mem(new_pmgr, alloc),
+           (old_size < new_size) ? old_size : new_size);
+    _mem_del_alloc(pool, alloc);
+    return new_alloc;
+}
+
+alloc_status mem_del_alloc(pool_pt pool, void* alloc) {
+    // a sharded pool gives the allocation back to the shard it came from
+    if (((pool_mgr_pt) pool)->shards != NULL) {
+        return _mem_sharded_del((pool_mgr_pt) pool, alloc);
+    }
+    // slab objects of a cached pool go to the thread's cache, which
+    // takes the lock only to flush; anything else takes the lock
+    if ((((pool_mgr_pt) pool)->flags & POOL_TCACHE) &&
+            (char *) alloc >= pool->mem &&
+            (char *) alloc < pool->mem + pool->total_size) {
+        alloc_status status = _mem_tcache_free((pool_mgr_pt) pool, alloc);
+        if (status != ALLOC_NOT_FREED) {
+            return status;
+        }
+    }
+    // if another thread holds the lock, leave the allocation on the
+    // remote free list for it to free, rather than wait
+    if (!MEM_POOL_TRYLOCK(pool)) {
+        if (_mem_remote_free((pool_mgr_pt) pool, alloc) == ALLOC_OK) {
+            return ALLOC_OK;
+        }
+        MEM_POOL_LOCK(pool);
+    }
+    _mem_remote_drain((pool_mgr_pt) pool);
+    alloc_status status = _mem_del_alloc(pool, alloc);
+    MEM_POOL_UNLOCK(pool);
+    return status;
+}
+
+static alloc_status _mem_del_alloc(pool_pt pool, void* alloc) {
+    
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+
+    // fixed-size blocks are addresses inside the pool too
+    if (pool->policy == FIXED) {
+        return _mem_fixed_free(new_pmgr, alloc);
+    }
+
+    // bump allocations are only given back by mem_pool_rewind() or
+    // mem_pool_reset()
+    if (pool->policy == BUMP) {
+        return ALLOC_FAIL;
+    }
+
+    // slab objects are addresses inside the pool, node handles never are
+    if (new_pmgr->slab_map != NULL &&
+            (char *) alloc >= pool->mem &&
+            (char *) alloc < pool->mem + pool->total_size) {
+        slab_pt slab = _mem_slab_find(new_pmgr, alloc);
+        if (slab == NULL) {
+            return ALLOC_FAIL;
+        }
+        // an object of a cached pool may be in use in the slab but
+        // sitting in a thread's cache
+        if ((new_pmgr->flags & POOL_TCACHE) && !_mem_slab_unlive(slab, alloc)) {
+            return ALLOC_FAIL;
+        }
+        return _mem_slab_free(new_pmgr, slab, alloc);
+    }
+
+    // the handle is the allocation's node, make sure it's valid, and
+    // that no remote free has it
+    node_pt node_handle = _mem_resolve_handle(new_pmgr, alloc);
+    if (node_handle == NULL || !_mem_node_claim(node_handle)) {
         return ALLOC_FAIL;
     }
+    
+    // convert to gap node
+    // allocated = 0 indicates a gap node
+    __atomic_store_n(&node_handle->allocated, 0, __ATOMIC_RELAXED);
+    _mem_node_unclaim(node_handle);
+    node_handle->dirty = node_handle->alloc_record.size;
+    
+    // update metadata (num_allocs, alloc_size)
+    --pool->num_allocs;
+    pool->alloc_size -= node_handle->alloc_record.size;
+
+    // buddy blocks only merge with their buddy
+    if (pool->policy == BUDDY) {
+        return _mem_buddy_free(new_pmgr, node_handle);
+    }
+    
+    // if the next node in the list is also a gap, merge into node handle
+    if ((node_handle->next != NULL) &&
+        (node_handle->next->allocated == 0)) {
+        if (_mem_remove_from_gap_ix(new_pmgr,
+                node_handle->next->alloc_record.size,
+                node_handle->next) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+        _mem_absorb_next(new_pmgr, node_handle);
+    }
+    
+    // if the prev node in the list is also a gap, merge into node handle
+    if ((node_handle->prev != NULL) &&
+        (node_handle->prev->allocated == 0)) {
+        if (_mem_remove_from_gap_ix(new_pmgr,
+                node_handle->prev->alloc_record.size,
+                node_handle->prev) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+        _mem_absorb_prev(new_pmgr, node_handle);
+    }
+
+    _mem_release_gap(new_pmgr, node_handle);
+    alloc_status status = _mem_add_to_gap_ix(new_pmgr, node_handle->alloc_record.size, node_handle);
+    
+    if (status == ALLOC_FAIL) {
+        return ALLOC_FAIL;
+    }
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_del_alloc_batch(pool_pt pool, void **allocs, size_t n) {
+    // a sharded pool's allocations may be from any shard, so they are
+    // given back one at a time
+    if (((pool_mgr_pt) pool)->shards != NULL) {
+        alloc_status status = ALLOC_OK;
+        for (size_t i = 0; i < n; ++i) {
+            if (_mem_sharded_del((pool_mgr_pt) pool, allocs[i]) != ALLOC_OK) {
+                status = ALLOC_FAIL;
+            }
+        }
+        return status;
+    }
+    MEM_POOL_LOCK(pool);
+    _mem_remote_drain((pool_mgr_pt) pool);
+    alloc_status status = _mem_del_alloc_batch(pool, allocs, n);
+    MEM_POOL_UNLOCK(pool);
+    return status;
+}
+
+static alloc_status _mem_del_alloc_batch(pool_pt pool, void **allocs, size_t n) {
+
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+    alloc_status status = ALLOC_OK;
+
+    // fixed-size blocks and buddy blocks are freed by their own rules,
+    // which already take constant or logarithmic time
+    if (pool->policy == FIXED || pool->policy == BUDDY || pool->policy == BUMP) {
+        for (size_t i = 0; i < n; ++i) {
+            if (_mem_del_alloc(pool, allocs[i]) != ALLOC_OK) {
+                status = ALLOC_FAIL;
+            }
+        }
+        return status;
+    }
+
+    // the freed nodes, sorted by address for the sweep below
+    node_pt *freed = malloc(n * sizeof(node_pt));
+    if (freed == NULL) {
+        for (size_t i = 0; i < n; ++i) {
+            if (_mem_del_alloc(pool, allocs[i]) != ALLOC_OK) {
+                status = ALLOC_FAIL;
+            }
+        }
+        return status;
+    }
+
+    // mark all targets as gaps; an invalid or repeated handle fails
+    // without stopping the rest
+    size_t num_freed = 0;
+    for (size_t i = 0; i < n; ++i) {
+        void *alloc = allocs[i];
+        if (new_pmgr->slab_map != NULL &&
+                (char *) alloc >= pool->mem &&
+                (char *) alloc < pool->mem + pool->total_size) {
+            continue;
+        }
+        node_pt node = _mem_resolve_handle(new_pmgr, alloc);
+        if (node == NULL || !_mem_node_claim(node)) {
+            status = ALLOC_FAIL;
+            continue;
+        }
+        __atomic_store_n(&node->allocated, 0, __ATOMIC_RELAXED);
+        _mem_node_unclaim(node);
+        node->dirty = node->alloc_record.size;
+
+        // update metadata (num_allocs, alloc_size)
+        --pool->num_allocs;
+        pool->alloc_size -= node->alloc_record.size;
+
+        freed[num_freed++] = node;
+    }
+    qsort(freed, num_freed, sizeof(node_pt), _mem_node_cmp);
+
+    // sweep the freed nodes in address order; the first of each run of
+    // adjacent gaps absorbs the rest, and only the gaps that were there
+    // before the batch are in the gap index
+    size_t i = 0;
+    while (i < num_freed) {
+        node_pt node = freed[i++];
+
+        // a gap ahead of the run is an old one, since a freed one would
+        // have absorbed this node already
+        if ((node->prev != NULL) &&
+            (node->prev->allocated == 0)) {
+            if (_mem_remove_from_gap_ix(new_pmgr,
+                    node->prev->alloc_record.size,
+                    node->prev) != ALLOC_OK) {
+                status = ALLOC_FAIL;
+            }
+            _mem_absorb_prev(new_pmgr, node);
+        }
+
+        // the gaps behind it are the next freed nodes or old gaps
+        while ((node->next != NULL) &&
+               (node->next->allocated == 0)) {
+            if (i < num_freed && node->next == freed[i]) {
+                ++i;
+            } else if (_mem_remove_from_gap_ix(new_pmgr,
+                    node->next->alloc_record.size,
+                    node->next) != ALLOC_OK) {
+                status = ALLOC_FAIL;
+            }
+            _mem_absorb_next(new_pmgr, node);
+        }
+
+        _mem_release_gap(new_pmgr, node);
+        if (_mem_add_to_gap_ix(new_pmgr, node->alloc_record.size, node) != ALLOC_OK) {
+            status = ALLOC_FAIL;
+        }
+    }
+
+    free(freed);
+
+    // slab objects go back last, as an empty slab's memory is freed
+    // like any allocation and may merge with the gaps made above
+    if (new_pmgr->slab_map != NULL) {
+        for (size_t j = 0; j < n; ++j) {
+            if ((char *) allocs[j] >= pool->mem &&
+                    (char *) allocs[j] < pool->mem + pool->total_size &&
+                    _mem_del_alloc(pool, allocs[j]) != ALLOC_OK) {
+                status = ALLOC_FAIL;
+            }
+        }
+    }
+
+    return status;
+}
+
+void * mem_find_alloc(pool_pt pool, size_t offset) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+
+    // only pools of nodes have handles to find
+    if (new_pmgr == NULL || new_pmgr->shards != NULL || new_pmgr->head == NULL ||
+            offset >= pool->total_size) {
+        return NULL;
+    }
+    MEM_POOL_LOCK(pool);
+    _mem_remote_drain(new_pmgr);
+    node_pt found = NULL;
+    for (node_pt node = new_pmgr->head; node != NULL; node = node->next) {
+        if (node->alloc_record.mem == pool->mem + offset) {
+            // a slab is the pool's own allocation, not the user's
+            slab_pt slab = (new_pmgr->slab_map != NULL) ?
+                    new_pmgr->slab_map[offset / MEM_SLAB_SIZE] : NULL;
+            if (node->allocated && (slab == NULL || slab->node != node)) {
+                found = node;
+            }
+            break;
+        }
+    }
+    MEM_POOL_UNLOCK(pool);
+    return found;
+}
+
+void * mem_alloc_mem(pool_pt pool, void *alloc) {
+    // a handle's memory does not move while it is allocated, so the lock
+    // is not needed to find it
+    if (pool == NULL || alloc == NULL) {
+        return NULL;
+    }
+    // the allocations of a sharded pool are handles of its shards, whose
+    // regions need not follow the pool's own memory
+    if (((pool_mgr_pt) pool)->shards != NULL) {
+        pool_mgr_pt shard = _mem_shard_owner((pool_mgr_pt) pool, alloc);
+        return (shard == NULL) ? NULL : _mem_alloc_mem(shard, alloc);
+    }
+    return _mem_alloc_mem((pool_mgr_pt) pool, alloc);
+}
+
+void mem_inspect_pool(pool_pt pool,
+                      pool_segment_pt *segments,
+                      unsigned *num_segments) {
+    if (((pool_mgr_pt) pool)->shards != NULL) {
+        _mem_sharded_inspect((pool_mgr_pt) pool, segments, num_segments);
+        return;
+    }
+    MEM_POOL_LOCK(pool);
+    _mem_remote_drain((pool_mgr_pt) pool);
+    _mem_inspect_pool(pool, segments, num_segments);
+    MEM_POOL_UNLOCK(pool);
+}
+
+static void _mem_inspect_pool(pool_pt pool,
+                              pool_segment_pt *segments,
+                              unsigned *num_segments) {
+    // get the mgr from the pool
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+
+    // a FIXED pool has no nodes, its segments are read off the bitmap
+    if (pool->policy == FIXED) {
+        unsigned count = pool->num_allocs + pool->num_gaps;
+        pool_segment_pt new_seg_array = calloc(count, sizeof(pool_segment_t));
+        if (new_seg_array == NULL) {
+            return;
+        }
+        _mem_fixed_inspect(new_pmgr, new_seg_array);
+        *segments = new_seg_array;
+        *num_segments = count;
+        return;
+    }
+
+    // a BUMP pool is its used prefix, as one allocation, and the rest
+    if (pool->policy == BUMP) {
+        size_t top = new_pmgr->bump_top;
+        unsigned count = (top > 0) + pool->num_gaps;
+        pool_segment_pt new_seg_array = calloc(count, sizeof(pool_segment_t));
+        if (new_seg_array == NULL) {
+            return;
+        }
+        if (top > 0) {
+            new_seg_array[0].size = top;
+            new_seg_array[0].allocated = 1;
+        }
+        if (pool->num_gaps > 0) {
+            new_seg_array[count - 1].size = pool->total_size - top;
+            new_seg_array[count - 1].allocated = 0;
+        }
+        *segments = new_seg_array;
+        *num_segments = count;
+        return;
+    }
+
+    // allocate the segments array with size == used_nodes
+    pool_segment_pt new_seg_array = calloc(new_pmgr->used_nodes, sizeof(pool_segment_t));
+    if (new_seg_array == NULL) {
+        return;
+    }
+    
+    // start at the segment at the beginning of the pool
+    node_pt it = new_pmgr->head;
+    assert(it != NULL);
+    
+    for (unsigned i = 0; i < new_pmgr->used_nodes; ++i) {
+        new_seg_array[i].size = it->alloc_record.size;
+        new_seg_array[i].allocated = it->allocated;
+        it = it->next;
+        if (it == NULL) {
+            break;
+        }
+    }
+    
+    // "return" the values
+    *segments = new_seg_array;
+    *num_segments = new_pmgr->used_nodes;
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+// order of nodes by the address of their memory
+static int _mem_node_cmp(const void *a, const void *b) {
+    uintptr_t mem_a = (uintptr_t) (*(const node_pt *) a)->alloc_record.mem;
+    uintptr_t mem_b = (uintptr_t) (*(const node_pt *) b)->alloc_record.mem;
+    if (mem_a != mem_b) {
+        return (mem_a < mem_b) ? -1 : 1;
+    }
+    // an empty allocation comes before the segment at the same address
+    node_pt node_a = *(const node_pt *) a;
+    node_pt node_b = *(const node_pt *) b;
+    if (node_a->alloc_record.size != node_b->alloc_record.size) {
+        return (node_a->alloc_record.size < node_b->alloc_record.size) ? -1 : 1;
+    }
+    // and empty allocations at one address keep their list order, as the
+    // sweep takes a freed node's gaps to be behind it
+    for (node_pt node = node_a->next;
+         node != NULL && (uintptr_t) node->alloc_record.mem == mem_a;
+         node = node->next) {
+        if (node == node_b) {
+            return -1;
+        }
+    }
+    return (node_a == node_b) ? 0 : 1;
+}
+
+static node_pt _mem_resolve_handle(pool_mgr_pt pool_mgr, void *alloc) {
+    // handles are the nodes returned by mem_new_alloc, so resolving one is
+    // a few comparisons: it must lie on a node boundary in one of this
+    // pool's node heap chunks, be an allocation, and describe memory
+    // inside the pool
+    if (!_mem_node_heap_holds(pool_mgr, alloc)) {
+        return NULL;
+    }
+
+    node_pt node = (node_pt) alloc;
+    if (!node->used || !node->allocated ||
+            node->alloc_record.mem < pool_mgr->pool.mem ||
+            node->alloc_record.mem + node->alloc_record.size >
+            pool_mgr->pool.mem + pool_mgr->pool.total_size) {
+        return NULL;
+    }
+#ifdef MEM_POOL_THREAD_SAFE
+    // an allocation on the remote free list is as good as freed
+    if (__atomic_load_n(&node->claim, __ATOMIC_RELAXED) == MEM_CLAIM_REMOTE) {
+        return NULL;
+    }
+#endif
+    return node;
+}
+
+// is alloc on a node boundary in one of the pool's node heap chunks; a
+// chunk is filled in before num_chunks counts it, so other threads may
+// ask without the lock. Chunks double in size, so the newest ones, which
+// are checked first, hold most of the nodes.
+static int _mem_node_heap_holds(pool_mgr_pt pool_mgr, void *alloc) {
+    uintptr_t handle = (uintptr_t) alloc;
+    unsigned i = __atomic_load_n(&pool_mgr->num_chunks, __ATOMIC_ACQUIRE);
+    while (i > 0) {
+        node_chunk_pt chunk = &pool_mgr->node_heap[--i];
+        uintptr_t base = (uintptr_t) chunk->nodes;
+        if (handle >= base && handle < base + chunk->capacity * sizeof(node_t)) {
+            return (handle - base) % sizeof(node_t) == 0;
+        }
+    }
+    return 0;
+}
+
+// pool memory starts on a page (the size is rounded up for aligned_alloc())
+static char * _mem_alloc_pool_mem(size_t size) {
+    size_t rounded = (size + MEM_ALIGN_MAX - 1) & ~(MEM_ALIGN_MAX - 1);
+    if (rounded < size) {
+        return NULL;
+    }
+    return aligned_alloc(MEM_ALIGN_MAX, (rounded > 0) ? rounded : MEM_ALIGN_MAX);
+}
+
+// the unit a pool's memory is mapped and given back in
+static size_t _mem_page_size(unsigned flags) {
+    return (flags & POOL_HUGE) ? MEM_HUGE_PAGE : mem_sys_page;
+}
+
+// POOL_MMAP pool memory is only reserved; a page takes memory when it is
+// first touched, and again after it is given back. POOL_HUGE memory is
+// whole huge pages: explicit ones if the build asks for them and the
+// system has them, else a mapping aligned for transparent huge pages.
+static char * _mem_map_pool_mem(size_t size, unsigned flags) {
+    size_t page = _mem_page_size(flags);
+    size_t rounded = (size + page - 1) & ~(page - 1);
+    if (rounded < size) {
+        return NULL;
+    }
+    if (rounded == 0) {
+        rounded = page;
+    }
+    if (!(flags & POOL_HUGE)) {
+        void *mem = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return (mem == MAP_FAILED) ? NULL : mem;
+    }
+
+#ifdef MEM_POOL_HUGETLB
+    // reserved up front, so that it fails here rather than on first touch
+    // when the system is out of huge pages
+    void *huge = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (huge != MAP_FAILED) {
+        return huge;
+    }
+#endif
+    // map a huge page more and trim the ends, so the pool starts on one
+    if (rounded + page < rounded) {
+        return NULL;
+    }
+    char *mem = mmap(NULL, rounded + page, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+    size_t lead = (size_t) (-(uintptr_t) mem & (page - 1));
+    if (lead > 0) {
+        munmap(mem, lead);
+    }
+    munmap(mem + lead + rounded, page - lead);
+    mem += lead;
+    // without transparent huge pages, this fails and the pool gets small ones
+    madvise(mem, rounded, MADV_HUGEPAGE);
+    return mem;
+}
+
+static void _mem_free_pool_mem(char *mem, size_t size, unsigned flags) {
+    if (flags & (POOL_MMAP | MEM_POOL_FILE)) {
+        size_t page = _mem_page_size(flags);
+        size_t rounded = (size + page - 1) & ~(page - 1);
+        munmap(mem, (rounded > 0) ? rounded : page);
+    } else {
+        free(mem);
+    }
+}
+
+// give the whole pages of [lo, hi) back to the system if there are at
+// least min bytes of them; they read as zeros when next touched. The
+// mapping goes on to the end of the pool's last page, which is whole.
+static void _mem_release_pages(pool_mgr_pt pool_mgr, char *lo, char *hi, size_t min) {
+    size_t page = _mem_page_size(pool_mgr->flags);
+    uintptr_t first = ((uintptr_t) lo + page - 1) & ~(page - 1);
+    uintptr_t last = (uintptr_t) hi & ~(page - 1);
+    if (hi == pool_mgr->pool.mem + pool_mgr->pool.total_size) {
+        last = ((uintptr_t) hi + page - 1) & ~(page - 1);
+    }
+    if (last > first && last - first >= min) {
+        madvise((void *) first, last - first, MADV_DONTNEED);
+    }
+}
+
+// give back the whole pages of a gap, once enough has been freed into it
+// since it last did; the pages it gave back before have no memory, so
+// going over them again costs little
+static void _mem_release_gap(pool_mgr_pt pool_mgr, node_pt node) {
+    if (!(pool_mgr->flags & POOL_MMAP) || node->dirty < MEM_RELEASE_MIN) {
+        return;
+    }
+    _mem_release_pages(pool_mgr, node->alloc_record.mem,
+                       node->alloc_record.mem + node->alloc_record.size, 0);
+    node->dirty = 0;
+}
+
+// add the pages of [mem, mem + size) to usage: those reserved, and those
+// of them that have memory now, counted in the system's pages
+static void _mem_usage_add(pool_usage_t *usage, char *mem, size_t size, unsigned flags) {
+    size_t page = _mem_page_size(flags);
+    size_t rounded = (size + page - 1) & ~(page - 1);
+    usage->reserved += rounded;
+
+    // only a mapped pool is asked page by page, others have it all
+    if (!(flags & POOL_MMAP)) {
+        usage->committed += rounded;
+        return;
+    }
+    // mincore() has a byte for each page of the system's size
+    unsigned char resident[1024];
+    size_t chunk = sizeof(resident) * mem_sys_page;
+    for (size_t offset = 0; offset < rounded; offset += chunk) {
+        size_t len = rounded - offset;
+        if (len > chunk) {
+            len = chunk;
+        }
+        if (mincore(mem + offset, len, resident) != 0) {
+            continue;
+        }
+        for (size_t page = 0; page < (len + mem_sys_page - 1) / mem_sys_page; ++page) {
+            usage->committed += (resident[page] & 1) ? mem_sys_page : 0;
+        }
+    }
+}
+
+// make the allocations of a pool's file again in the pool just opened:
+// with one gap, at the end, each allocation is placed right after the one
+// before, so the gaps in between are allocated too, and then freed
+static alloc_status _mem_file_restore(pool_mgr_pt pool_mgr, const file_record_t *records, size_t n) {
+    if (n == 0) {
+        return ALLOC_OK;
+    }
+    size_t *sizes = malloc(2 * n * sizeof(size_t));
+    void **allocs = malloc(2 * n * sizeof(void *));
+    size_t *gaps = malloc(n * sizeof(size_t));
+    if (sizes == NULL || allocs == NULL || gaps == NULL) {
+        free(sizes);
+        free(allocs);
+        free(gaps);
+        return ALLOC_FAIL;
+    }
+
+    // the records must be in address order, apart and inside the pool;
+    // a zero-byte allocation shares its offset with the one after it
+    size_t total_size = pool_mgr->pool.total_size;
+    size_t count = 0;
+    size_t num_gaps = 0;
+    size_t end = 0;
+    alloc_status status = ALLOC_OK;
+    for (size_t i = 0; i < n && status == ALLOC_OK; ++i) {
+        if (records[i].offset < end || records[i].offset > total_size ||
+                records[i].size > total_size - records[i].offset) {
+            status = ALLOC_FAIL;
+            break;
+        }
+        if (records[i].offset > end) {
+            gaps[num_gaps++] = count;
+            sizes[count++] = records[i].offset - end;
+        }
+        sizes[count++] = records[i].size;
+        end = records[i].offset + records[i].size;
+    }
+    if (status == ALLOC_OK) {
+        status = _mem_new_alloc_batch(&pool_mgr->pool, sizes, count, allocs);
+    }
+    if (status == ALLOC_OK) {
+        for (size_t i = 0; i < num_gaps; ++i) {
+            allocs[i] = allocs[gaps[i]];
+        }
+        status = _mem_del_alloc_batch(&pool_mgr->pool, allocs, num_gaps);
+    }
+
+    free(sizes);
+    free(allocs);
+    free(gaps);
+    return status;
+}
+
+// write a record of every allocation after the pool memory in the file,
+// and then the header that counts them, once the memory is written. The
+// records never go over the table the header names: they go ahead of it
+// if they fit there, or after it, so a crash before the header is written
+// leaves the file as it was at the last sync
+static alloc_status _mem_file_sync(pool_mgr_pt pool_mgr) {
+    pool_pt pool = &pool_mgr->pool;
+    size_t rounded = (pool->total_size + MEM_ALIGN_MAX - 1) & ~(MEM_ALIGN_MAX - 1);
+    int fd = pool_mgr->file_fd;
+
+    // the table the file has now
+    file_header_t header;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+        return ALLOC_FAIL;
+    }
+
+    // a pool with no allocations has no nodes to ask (after
+    // mem_pool_close_force() they are still there)
+    size_t n = 0;
+    file_record_t *records = malloc((pool->num_allocs + 1) * sizeof(file_record_t));
+    if (records == NULL) {
+        return ALLOC_FAIL;
+    }
+    for (node_pt node = pool_mgr->head; pool->num_allocs > 0 && node != NULL; node = node->next) {
+        if (node->allocated) {
+            records[n].offset = (uint64_t) (node->alloc_record.mem - pool->mem);
+            records[n].size = node->alloc_record.size;
+            ++n;
+        }
+    }
+
+    size_t bytes = n * sizeof(file_record_t);
+    uint64_t first = MEM_FILE_DATA + rounded;
+    uint64_t table = header.table + header.num_records * sizeof(file_record_t);
+    if (header.table > first && header.table - first >= bytes) {
+        table = first;
+    }
+    header.num_records = n;
+    header.table = table;
+
+    alloc_status status = ALLOC_OK;
+    if (msync(pool->mem, rounded, MS_SYNC) != 0 ||
+            pwrite(fd, records, bytes, (off_t) table) != (ssize_t) bytes ||
+            fsync(fd) != 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+            fsync(fd) != 0 ||
+            ftruncate(fd, (off_t) (table + bytes)) != 0) {
+        status = ALLOC_FAIL;
+    }
+    free(records);
+    return status;
+}
+
+// does the gap hold size bytes from its first address aligned to alignment
+static int _mem_gap_fits_aligned(char *mem, size_t gap_size, size_t size, size_t alignment) {
+    size_t pad = (size_t) (-(uintptr_t) mem & (alignment - 1));
+    return pad <= gap_size && size <= gap_size - pad;
+}
+
+// the gap the pool's policy picks for an aligned allocation, NULL if none
+static node_pt _mem_find_gap_aligned(pool_mgr_pt pool_mgr, size_t size, size_t alignment) {
+    if (pool_mgr->pool.policy == FIRST_FIT) {
+
+        // the first gap by address that fits once aligned; the vector
+        // scan skips the gaps that are too small either way
+        unsigned pos = 0;
+        while ((pos = mem_scan_sizes(pool_mgr->ff_size, pos, pool_mgr->ff_len, size)) <
+                pool_mgr->ff_len) {
+            if (pos != pool_mgr->ff_hole &&
+                    _mem_gap_fits_aligned(pool_mgr->ff_mem[pos], pool_mgr->ff_size[pos],
+                                          size, alignment)) {
+                return pool_mgr->ff_node[pos];
+            }
+            ++pos;
+        }
+
+    } else if (pool_mgr->pool.policy == BEST_FIT) {
+
+        // visit the gaps of at least size bytes in tree order, the
+        // smallest first; one of alignment - 1 more bytes is sure to fit,
+        // so only a few are visited. The tree is never 64 levels deep.
+        unsigned stack[64];
+        unsigned depth = 0;
+        unsigned slot = pool_mgr->gap_root;
+        for (;;) {
+            while (slot != MEM_GAP_IX_NIL) {
+                if (size <= pool_mgr->gap_ix[slot].size) {
+                    stack[depth++] = slot;
+                    slot = pool_mgr->gap_ix[slot].left;
+                } else {
+                    slot = pool_mgr->gap_ix[slot].right;
+                }
+            }
+            if (depth == 0) {
+                break;
+            }
+            slot = stack[--depth];
+            node_pt node = pool_mgr->gap_ix[slot].node;
+            if (_mem_gap_fits_aligned(node->alloc_record.mem, node->alloc_record.size,
+                                      size, alignment)) {
+                return node;
+            }
+            slot = pool_mgr->gap_ix[slot].right;
+        }
+
+    } else if (pool_mgr->pool.policy == TLSF_FIT) {
+
+        // ask for enough slack to align anywhere in the gap
+        if (size + alignment - 1 >= size) {
+            unsigned slot = _mem_find_gap_tlsf(pool_mgr, size + alignment - 1);
+            if (slot != MEM_GAP_IX_NIL) {
+                return pool_mgr->gap_ix[slot].node;
+            }
+        }
+
+    } else if (pool_mgr->pool.policy == NEXT_FIT) {
+
+        // walk on from the rover, wrapping around to the head once
+        node_pt start = pool_mgr->rover;
+        node_pt it = start;
+        do {
+            if (it->allocated == 0 &&
+                    _mem_gap_fits_aligned(it->alloc_record.mem, it->alloc_record.size,
+                                          size, alignment)) {
+                return it;
+            }
+            it = (it->next != NULL) ? it->next : pool_mgr->head;
+        } while (it != start);
+    }
+    return NULL;
+}
+
+// the gap the pool's policy picks for size bytes, NULL if none
+static node_pt _mem_find_gap(pool_mgr_pt pool_mgr, size_t size) {
+    if (pool_mgr->pool.policy == FIRST_FIT) {
+
+        // scan the gap sizes in address order for the first that fits
+        unsigned pos = _mem_find_gap_ff(pool_mgr, size);
+        if (pos != MEM_GAP_IX_NIL) { // found gap
+            return pool_mgr->ff_node[pos];
+        }
+
+    } else if (pool_mgr->pool.policy == BEST_FIT) {
+
+        // the gap tree is ordered by size, so the smallest gap that
+        // fits (lowest node address on ties) is found in O(log n)
+        unsigned slot = _mem_find_gap_ix(pool_mgr, size);
+        if (slot != MEM_GAP_IX_NIL) { // found gap
+            return pool_mgr->gap_ix[slot].node;
+        }
+
+    } else if (pool_mgr->pool.policy == TLSF_FIT) {
+
+        // two bitmap lookups pick a size class whose gaps all fit
+        unsigned slot = _mem_find_gap_tlsf(pool_mgr, size);
+        if (slot != MEM_GAP_IX_NIL) { // found gap
+            return pool_mgr->gap_ix[slot].node;
+        }
+
+    } else if (pool_mgr->pool.policy == NEXT_FIT) {
+
+        // walk the segments like FIRST_FIT, but resume where the previous
+        // allocation ended, wrapping around to the head once
+        node_pt start = pool_mgr->rover;
+        node_pt it = start;
+        do {
+            if (it->allocated == 0 && size <= it->alloc_record.size) { // found gap
+                return it;
+            }
+            it = (it->next != NULL) ? it->next : pool_mgr->head;
+        } while (it != start);
+    }
+    return NULL;
+}
+
+// turn the gap into an allocation of size bytes at its start; the caller
+// updates the pool metadata
+static node_pt _mem_take_gap(pool_mgr_pt pool_mgr, node_pt node, size_t size) {
+    // At this point, node is a gap, and
+    // node->alloc_record.size; is the size of the gap
+    if (_mem_remove_from_gap_ix(pool_mgr, node->alloc_record.size, node) != ALLOC_OK) {
+        return NULL;
+    }
+    __atomic_store_n(&node->allocated, 1, __ATOMIC_RELAXED);
+
+    // convert gap_node to an allocation node of given size
+    // (it keeps the gap's address, the remainder follows it)
+    if (size < node->alloc_record.size &&
+            _mem_split_node(pool_mgr, node, size) == NULL) {
+        // no node for the remainder, put the gap back
+        __atomic_store_n(&node->allocated, 0, __ATOMIC_RELAXED);
+        _mem_add_to_gap_ix(pool_mgr, node->alloc_record.size, node);
+        return NULL;
+    }
+
+    // the next NEXT_FIT search starts right after this allocation
+    pool_mgr->rover = (node->next != NULL) ? node->next : pool_mgr->head;
+
+    return node;
+}
+
+// the memory behind a handle: addresses in the pool are their own memory,
+// and anything else is a node, as node heaps are never in pool memory
+static char * _mem_alloc_mem(pool_mgr_pt pool_mgr, void *alloc) {
+    if ((char *) alloc >= pool_mgr->pool.mem &&
+            (char *) alloc < pool_mgr->pool.mem + pool_mgr->pool.total_size) {
+        return (char *) alloc;
+    }
+    return ((node_pt) alloc)->alloc_record.mem;
+}
+
+// shrink an allocation, or grow it into the gap that follows it
+static alloc_status _mem_resize_in_place(pool_mgr_pt pool_mgr, node_pt node, size_t new_size) {
+    size_t old_size = node->alloc_record.size;
+    node_pt next = node->next;
+    int next_is_gap = (next != NULL && next->allocated == 0);
+
+    if (new_size < old_size) {
+        size_t diff = old_size - new_size;
+        node_pt tail = next;
+        if (next_is_gap) {
+            // the tail joins the next gap, which now starts earlier
+            if (_mem_remove_from_gap_ix(pool_mgr, next->alloc_record.size, next) != ALLOC_OK) {
+                return ALLOC_FAIL;
+            }
+            next->alloc_record.mem -= diff;
+            next->alloc_record.size += diff;
+            next->dirty += diff;
+            node->alloc_record.size = new_size;
+            _mem_add_to_gap_ix(pool_mgr, next->alloc_record.size, next);
+        } else if ((tail = _mem_split_node(pool_mgr, node, new_size)) == NULL) {
+            // the tail becomes a gap of its own
+            return ALLOC_FAIL;
+        } else {
+            tail->dirty = diff;
+        }
+        // the tail is freed, so its pages go back as a freed allocation's do
+        _mem_release_gap(pool_mgr, tail);
+        pool_mgr->pool.alloc_size -= diff;
+    } else if (new_size > old_size) {
+        size_t diff = new_size - old_size;
+        if (!next_is_gap || next->alloc_record.size < diff) {
+            return ALLOC_FAIL;
+        }
+        // take the head of the next gap, or all of it
+        if (_mem_remove_from_gap_ix(pool_mgr, next->alloc_record.size, next) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+        if (next->alloc_record.size == diff) {
+            _mem_absorb_next(pool_mgr, node);
+        } else {
+            next->alloc_record.mem += diff;
+            next->alloc_record.size -= diff;
+            node->alloc_record.size = new_size;
+            _mem_add_to_gap_ix(pool_mgr, next->alloc_record.size, next);
+        }
+        pool_mgr->pool.alloc_size += diff;
+    }
+    return ALLOC_OK;
+}
+
+static node_pt _mem_split_node(pool_mgr_pt pool_mgr, node_pt node, size_t size) {
+    // take an unused node for the remainder
+    node_pt new_gap = _mem_get_node(pool_mgr);
+    if (new_gap == NULL) {
+        return NULL;
+    }
+    new_gap->alloc_record.mem = node->alloc_record.mem + size;
+    new_gap->alloc_record.size = node->alloc_record.size - size;
+    __atomic_store_n(&new_gap->allocated, 0, __ATOMIC_RELAXED);
+    new_gap->dirty = (node->dirty < new_gap->alloc_record.size) ? node->dirty : new_gap->alloc_record.size;
+    node->alloc_record.size = size;
+
+    // link it in right after the node
+    if (node->next != NULL) {
+        node->next->prev = new_gap;
+    }
+    new_gap->next = node->next;
+    node->next = new_gap;
+    new_gap->prev = node;
+
+    _mem_add_to_gap_ix(pool_mgr, new_gap->alloc_record.size, new_gap);
+    return new_gap;
+}
+
+static void _mem_absorb_next(pool_mgr_pt pool_mgr, node_pt node) {
+    node_pt tmp = node->next;
+
+    // add the sizes
+    node->alloc_record.size += tmp->alloc_record.size;
+    node->dirty += tmp->dirty;
+
+    // update linked list:
+    // IF next node has a continuing node, give
+    // THAT node a new prev. We are merging the
+    // node->next INTO node
+    if (tmp->next) {
+        tmp->next->prev = node;
+    }
+    node->next = tmp->next;
+
+    // keep the NEXT_FIT rover on a live node
+    if (pool_mgr->rover == tmp) {
+        pool_mgr->rover = node;
+    }
+
+    // update node as unused (also updates used nodes)
+    _mem_put_node(pool_mgr, tmp);
+}
+
+static void _mem_absorb_prev(pool_mgr_pt pool_mgr, node_pt node) {
+    node_pt tmp = node->prev;
+
+    // add the sizes, the merged segment starts where prev did
+    node->alloc_record.size += tmp->alloc_record.size;
+    node->alloc_record.mem = tmp->alloc_record.mem;
+    node->dirty += tmp->dirty;
+
+    // update linked list:
+    // IF prev node has a continuing node, give
+    // THAT node a new next. We are merging the
+    // node->prev INTO node
+    if (tmp->prev) {
+        tmp->prev->next = node;
+    }
+    node->prev = tmp->prev;
+    if (pool_mgr->head == tmp) {
+        pool_mgr->head = node;
+    }
+
+    // keep the NEXT_FIT rover on a live node
+    if (pool_mgr->rover == tmp) {
+        pool_mgr->rover = node;
+    }
+
+    // update node as unused (also updates used nodes)
+    _mem_put_node(pool_mgr, tmp);
+}
+
+// smallest power of two block, of at least the minimum order, holding size
+static size_t _mem_buddy_block(size_t size) {
+    size_t block = (size_t) 1 << MEM_BUDDY_MIN_ORDER;
+    while (block < size) {
+        if (block << 1 == 0) {
+            return 0; // too large for any block
+        }
+        block <<= 1;
+    }
+    return block;
+}
+
+// carve the whole pool into the largest aligned power of two blocks
+static alloc_status _mem_buddy_init(pool_mgr_pt pool_mgr) {
+    node_pt node = pool_mgr->head;
+
+    // taking the blocks in decreasing size keeps every block aligned to
+    // its size relative to the start of the pool; a remainder smaller
+    // than the minimum block stays behind as a gap that never merges
+    while (node->alloc_record.size >= ((size_t) 1 << MEM_BUDDY_MIN_ORDER)) {
+        size_t size = node->alloc_record.size;
+        size_t block = (size_t) 1 << (63 - __builtin_clzll((unsigned long long) size));
+        if (block == size) {
+            break;
+        }
+        // the split indexes the rest, which is carved next
+        if (_mem_remove_from_gap_ix(pool_mgr, size, node) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+        node_pt rest = _mem_split_node(pool_mgr, node, block);
+        _mem_add_to_gap_ix(pool_mgr, block, node);
+        if (rest == NULL) {
+            return ALLOC_FAIL;
+        }
+        node = rest;
+    }
+    return ALLOC_OK;
+}
+
+static void * _mem_buddy_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    size_t block = _mem_buddy_block(size);
+    if (block == 0) {
+        return NULL;
+    }
+
+    // free blocks are filed in the TLSF_FIT size classes, where each power
+    // of two has a class of its own, so this is the smallest free block
+    // that is large enough
+    unsigned slot = _mem_find_gap_tlsf(pool_mgr, block);
+    if (slot == MEM_GAP_IX_NIL) {
+        return NULL;
+    }
+    node_pt node = pool_mgr->gap_ix[slot].node;
+    if (_mem_remove_from_gap_ix(pool_mgr, node->alloc_record.size, node) != ALLOC_OK) {
+        return NULL;
+    }
+
+    // split it in halves down to the block size, freeing the upper halves
+    while (node->alloc_record.size > block) {
+        if (_mem_split_node(pool_mgr, node, node->alloc_record.size / 2) == NULL) {
+            // no node for the upper half, give back what we have
+            _mem_buddy_free(pool_mgr, node);
+            return NULL;
+        }
+    }
+
+    // the whole block is allocated
+    __atomic_store_n(&node->allocated, 1, __ATOMIC_RELAXED);
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size += block;
+
+    return (alloc_pt) node;
+}
+
+static alloc_status _mem_buddy_free(pool_mgr_pt pool_mgr, node_pt node) {
+    // a block's buddy is the other half of the block they were split from;
+    // it is adjacent, so it is either the next or the prev node, and it
+    // can be merged only if it is a gap that has not been split further
+    for (;;) {
+        size_t block = node->alloc_record.size;
+        size_t offset = (size_t) (node->alloc_record.mem - pool_mgr->pool.mem);
+        node_pt buddy = (offset & block) ? node->prev : node->next;
+
+        if (buddy == NULL || buddy->allocated ||
+                buddy->alloc_record.size != block) {
+            break;
+        }
+
+        if (_mem_remove_from_gap_ix(pool_mgr, block, buddy) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+        if (buddy == node->next) {
+            _mem_absorb_next(pool_mgr, node);
+        } else {
+            _mem_absorb_prev(pool_mgr, node);
+        }
+    }
+
+    _mem_release_gap(pool_mgr, node);
+    return _mem_add_to_gap_ix(pool_mgr, node->alloc_record.size, node);
+}
+
+// size class of an allocation of up to MEM_SLAB_MAX_SIZE bytes
+static unsigned _mem_slab_class(size_t size) {
+    unsigned size_class = 0;
+    while (((size_t) 1 << (MEM_SLAB_MIN_ORDER + size_class)) < size) {
+        ++size_class;
+    }
+    return size_class;
+}
+
+static void * _mem_slab_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned size_class = _mem_slab_class(size);
+    slab_pt slab = pool_mgr->slab_partial[size_class];
+
+    // objects of a cached pool change hands in the caches, where nobody
+    // keeps track of what was asked for, so they count as a whole object
+    if (pool_mgr->flags & POOL_TCACHE) {
+        size = (size_t) 1 << (MEM_SLAB_MIN_ORDER + size_class);
+    }
+
+    if (slab == NULL) {
+        // take a new slab from the pool; it is bookkeeping, not a user
+        // allocation, so it is kept out of the pool metadata. A cached
+        // pool aligns it to its granule, so that a cache can find the
+        // slab of an object without the lock (see _mem_tcache_free)
+        node_pt node = (pool_mgr->flags & POOL_TCACHE) ?
+                _mem_new_alloc_aligned(&pool_mgr->pool, MEM_SLAB_SIZE, MEM_SLAB_SIZE) :
+                _mem_new_alloc(&pool_mgr->pool, MEM_SLAB_SIZE);
+        if (node == NULL) {
+            return NULL;
+        }
+        pool_mgr->pool.num_allocs -= 1;
+        pool_mgr->pool.alloc_size -= node->alloc_record.size;
+
+        slab = calloc(1, sizeof(slab_t));
+        if (slab == NULL) {
+            pool_mgr->pool.num_allocs += 1;
+            pool_mgr->pool.alloc_size += node->alloc_record.size;
+            _mem_del_alloc(&pool_mgr->pool, node);
+            return NULL;
+        }
+        slab->mem = node->alloc_record.mem;
+        slab->node = node;
+        slab->size_class = size_class;
+        slab->obj_size = 1u << (MEM_SLAB_MIN_ORDER + size_class);
+        slab->num_objs = MEM_SLAB_SIZE / slab->obj_size;
+        slab->num_free = slab->num_objs;
+        for (unsigned i = 0; i < slab->num_objs; ++i) {
+            slab->free_map[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
+        pool_mgr->slab_map[(slab->mem - pool_mgr->pool.mem) / MEM_SLAB_SIZE] = slab;
+        pool_mgr->slab_partial[size_class] = slab;
+    }
+
+    // the lowest free object of the first slab with any
+    unsigned word = 0;
+    while (slab->free_map[word] == 0) {
+        ++word;
+    }
+    unsigned index = word * 64 + __builtin_ctzll(slab->free_map[word]);
+    slab->free_map[word] &= ~((uint64_t) 1 << (index % 64));
+    slab->req_size[index] = (unsigned short) size;
+    if (pool_mgr->flags & POOL_TCACHE) {
+        __atomic_fetch_or(&slab->live_map[word], (uint64_t) 1 << (index % 64), __ATOMIC_RELAXED);
+    }
+
+    // a full slab leaves the list until an object comes back
+    if (--slab->num_free == 0) {
+        pool_mgr->slab_partial[size_class] = slab->next;
+        if (slab->next != NULL) {
+            slab->next->prev = NULL;
+        }
+        slab->next = NULL;
+    }
+
+    // update metadata (num_allocs, alloc_size)
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size += size;
+
+    return slab->mem + (size_t) index * slab->obj_size;
+}
+
+static slab_pt _mem_slab_find(pool_mgr_pt pool_mgr, void *alloc) {
+    // a slab spans at most two granules, so the object's slab starts
+    // either in the object's granule or in the one before
+    size_t offset = (size_t) ((char *) alloc - pool_mgr->pool.mem);
+    size_t granule = offset / MEM_SLAB_SIZE;
+    slab_pt slab = pool_mgr->slab_map[granule];
+    if (slab == NULL || (char *) alloc < slab->mem) {
+        slab = (granule > 0) ? pool_mgr->slab_map[granule - 1] : NULL;
+        if (slab == NULL || (char *) alloc >= slab->mem + MEM_SLAB_SIZE) {
+            return NULL;
+        }
+    }
+    return slab;
+}
+
+// index of the object in use that starts at alloc, MEM_SLAB_MAX_OBJS if none
+static unsigned _mem_slab_index(slab_pt slab, void *alloc) {
+    size_t offset = (size_t) ((char *) alloc - slab->mem);
+    unsigned index = (unsigned) (offset / slab->obj_size);
+    if (offset % slab->obj_size != 0 || index >= slab->num_objs ||
+            (slab->free_map[index / 64] & ((uint64_t) 1 << (index % 64)))) {
+        return MEM_SLAB_MAX_OBJS;
+    }
+    return index;
+}
+
+// POOL_TCACHE: take the object from the user, 0 if the user does not hold
+// it; the bit is cleared atomically, as caches do it without the lock
+static int _mem_slab_unlive(slab_pt slab, void *alloc) {
+    size_t offset = (size_t) ((char *) alloc - slab->mem);
+    unsigned index = (unsigned) (offset / slab->obj_size);
+    if (offset % slab->obj_size != 0 || index >= slab->num_objs) {
+        return 0;
+    }
+    uint64_t bit = (uint64_t) 1 << (index % 64);
+    return (__atomic_fetch_and(&slab->live_map[index / 64], ~bit, __ATOMIC_RELAXED) & bit) != 0;
+}
+
+static alloc_status _mem_slab_free(pool_mgr_pt pool_mgr, slab_pt slab, void *alloc) {
+    // the address has to be the start of an object that is in use
+    unsigned index = _mem_slab_index(slab, alloc);
+    if (index == MEM_SLAB_MAX_OBJS) {
+        return ALLOC_FAIL;
+    }
+    slab->free_map[index / 64] |= (uint64_t) 1 << (index % 64);
+
+    // update metadata (num_allocs, alloc_size)
+    pool_mgr->pool.num_allocs -= 1;
+    pool_mgr->pool.alloc_size -= slab->req_size[index];
+
+    // a slab that was full has free objects again
+    slab_pt *list = &pool_mgr->slab_partial[slab->size_class];
+    if (slab->num_free++ == 0) {
+        slab->prev = NULL;
+        slab->next = *list;
+        if (*list != NULL) {
+            (*list)->prev = slab;
+        }
+        *list = slab;
+    }
+
+    // an empty slab goes back to the pool, unless it is the last one of
+    // its class, which is kept so alternating alloc/free does not thrash
+    if (slab->num_free == slab->num_objs &&
+            (slab->next != NULL || slab->prev != NULL)) {
+        _mem_slab_release(pool_mgr, slab);
+    }
+    return ALLOC_OK;
+}
+
+// unlink an empty slab and give its memory back to the pool
+static void _mem_slab_release(pool_mgr_pt pool_mgr, slab_pt slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        pool_mgr->slab_partial[slab->size_class] = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    pool_mgr->slab_map[(slab->mem - pool_mgr->pool.mem) / MEM_SLAB_SIZE] = NULL;
+
+    // it was never counted as an allocation, see _mem_slab_alloc
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size += slab->node->alloc_record.size;
+    _mem_del_alloc(&pool_mgr->pool, slab->node);
+    free(slab);
+}
+
+// forget every slab at once, for when the whole pool is emptied
+static void _mem_slab_drop_all(pool_mgr_pt pool_mgr) {
+    if (pool_mgr->slab_map == NULL) {
+        return;
+    }
+    // every slab is mapped from the granule it starts in
+    size_t granules = pool_mgr->pool.total_size / MEM_SLAB_SIZE + 1;
+    for (size_t i = 0; i < granules; ++i) {
+        free(pool_mgr->slab_map[i]);
+        pool_mgr->slab_map[i] = NULL;
+    }
+    for (unsigned i = 0; i < MEM_SLAB_NUM_CLASSES; ++i) {
+        pool_mgr->slab_partial[i] = NULL;
+    }
+}
+
+// the calling thread's cache of a POOL_TCACHE pool, made on first use
+static tcache_pt _mem_tcache_get(pool_mgr_pt pool_mgr) {
+    tcache_map_t *entry = &mem_tcache_map[((uintptr_t) pool_mgr / sizeof(pool_mgr_t)) %
+                                          MEM_TCACHE_MAP_SIZE];
+    if (entry->pool_mgr == pool_mgr && entry->serial == pool_mgr->serial) {
+        return entry->cache;
+    }
+
+    // not seen lately, look for it among the pool's caches
+    MEM_POOL_LOCK(pool_mgr);
+    tcache_pt cache = pool_mgr->tcaches;
+    while (cache != NULL && cache->owner != &mem_tcache_owner) {
+        cache = cache->next;
+    }
+    if (cache == NULL) {
+        cache = calloc(1, sizeof(tcache_t));
+        if (cache != NULL) {
+            cache->owner = &mem_tcache_owner;
+            cache->next = pool_mgr->tcaches;
+            cache->pool_mgr = pool_mgr;
+            cache->thread_next = mem_tcache_list;
+            pool_mgr->tcaches = cache;
+            mem_tcache_list = cache;
+#ifdef MEM_POOL_THREAD_SAFE
+            // have the thread's caches flushed when it exits
+            pthread_once(&mem_tcache_once, _mem_tcache_key_init);
+            pthread_setspecific(mem_tcache_key, &mem_tcache_owner);
+#endif
+        }
+    }
+    MEM_POOL_UNLOCK(pool_mgr);
+
+    if (cache != NULL) {
+        entry->pool_mgr = pool_mgr;
+        entry->serial = pool_mgr->serial;
+        entry->cache = cache;
+    }
+    return cache;
+}
+
+static void * _mem_tcache_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    tcache_pt cache = _mem_tcache_get(pool_mgr);
+    if (cache == NULL) {
+        return NULL;
+    }
+    unsigned size_class = _mem_slab_class(size);
+
+    // an empty cache takes a batch of objects under one lock
+    if (cache->count[size_class] == 0) {
+        MEM_POOL_LOCK(pool_mgr);
+        while (cache->count[size_class] < MEM_TCACHE_BATCH) {
+            void *obj = _mem_slab_alloc(pool_mgr, size);
+            if (obj == NULL) {
+                break;
+            }
+            _mem_slab_unlive(_mem_slab_find(pool_mgr, obj), obj);
+            cache->objs[size_class][cache->count[size_class]++] = obj;
+        }
+        MEM_POOL_UNLOCK(pool_mgr);
+        unsigned count = cache->count[size_class];
+        if (count == 0) {
+            return NULL;
+        }
+        // the stack is popped from the top, so turn it over to hand the
+        // objects out in address order
+        void **objs = cache->objs[size_class];
+        for (unsigned i = 0; i < count / 2; ++i) {
+            void *obj = objs[i];
+            objs[i] = objs[count - 1 - i];
+            objs[count - 1 - i] = obj;
+        }
+    }
+    // the object goes to the user, who alone may give it back
+    void *obj = cache->objs[size_class][--cache->count[size_class]];
+    slab_pt slab = pool_mgr->slab_map[(size_t) ((char *) obj - pool_mgr->pool.mem) / MEM_SLAB_SIZE];
+    size_t index = (size_t) ((char *) obj - slab->mem) / slab->obj_size;
+    __atomic_fetch_or(&slab->live_map[index / 64], (uint64_t) 1 << (index % 64), __ATOMIC_RELAXED);
+    return obj;
+}
+
+// ALLOC_NOT_FREED if alloc cannot be a slab object or the thread has no
+// cache, for the locked path to decide; ALLOC_FAIL if it is an object
+// the user does not hold, such as one freed before
+static alloc_status _mem_tcache_free(pool_mgr_pt pool_mgr, void *alloc) {
+    // slabs of a cached pool start on a granule, so the object's granule
+    // maps to its slab; that entry stays put while the object is in use
+    size_t offset = (size_t) ((char *) alloc - pool_mgr->pool.mem);
+    slab_pt slab = pool_mgr->slab_map[offset / MEM_SLAB_SIZE];
+    if (slab == NULL || offset % slab->obj_size != 0) {
+        return ALLOC_NOT_FREED;
+    }
+    tcache_pt cache = _mem_tcache_get(pool_mgr);
+    if (cache == NULL) {
+        return ALLOC_NOT_FREED;
+    }
+    if (!_mem_slab_unlive(slab, alloc)) {
+        return ALLOC_FAIL;
+    }
+
+    // a full cache gives back a batch of objects under one lock
+    unsigned size_class = slab->size_class;
+    if (cache->count[size_class] == MEM_TCACHE_SIZE) {
+        _mem_tcache_flush(pool_mgr, cache, size_class, MEM_TCACHE_BATCH);
+    }
+    cache->objs[size_class][cache->count[size_class]++] = alloc;
+    return ALLOC_OK;
+}
+
+// give the n objects at the bottom of a cache's stack back to their slabs,
+// keeping the most recently freed ones, which are likeliest to be warm
+static void _mem_tcache_flush(pool_mgr_pt pool_mgr, tcache_pt cache, unsigned size_class, unsigned n) {
+    void **objs = cache->objs[size_class];
+    if (n == 0) {
+        return;
+    }
+    MEM_POOL_LOCK(pool_mgr);
+    for (unsigned i = 0; i < n; ++i) {
+        _mem_slab_free(pool_mgr, _mem_slab_find(pool_mgr, objs[i]), objs[i]);
+    }
+    MEM_POOL_UNLOCK(pool_mgr);
+    cache->count[size_class] -= n;
+    memmove(objs, objs + n, cache->count[size_class] * sizeof(void *));
+}
+
+// give back the objects of every thread's cache, for mem_pool_close(),
+// when no other thread may use the pool any more
+static void _mem_tcache_drain(pool_mgr_pt pool_mgr) {
+    for (tcache_pt cache = pool_mgr->tcaches; cache != NULL; cache = cache->next) {
+        for (unsigned i = 0; i < MEM_SLAB_NUM_CLASSES; ++i) {
+            _mem_tcache_flush(pool_mgr, cache, i, cache->count[i]);
+        }
+    }
+}
+
+// forget the objects of every thread's cache, for when the whole pool is
+// emptied; the caches themselves stay with the pool
+static void _mem_tcache_discard(pool_mgr_pt pool_mgr) {
+    for (tcache_pt cache = pool_mgr->tcaches; cache != NULL; cache = cache->next) {
+        memset(cache->count, 0, sizeof(cache->count));
+    }
+}
+
+// free the caches of a pool being closed: the calling thread's and those
+// of threads that have exited; a thread still running keeps its cache,
+// cut off from the pool, and frees it when it exits
+static void _mem_tcache_release(pool_mgr_pt pool_mgr) {
+    MEM_STORE_LOCK();
+    while (pool_mgr->tcaches != NULL) {
+        tcache_pt cache = pool_mgr->tcaches;
+        pool_mgr->tcaches = cache->next;
+        if (cache->owner == &mem_tcache_owner) {
+            tcache_pt *link = &mem_tcache_list;
+            while (*link != cache) {
+                link = &(*link)->thread_next;
+            }
+            *link = cache->thread_next;
+            free(cache);
+        } else if (cache->owner == NULL) {
+            free(cache);
+        } else {
+            cache->pool_mgr = NULL;
+        }
+    }
+    MEM_STORE_UNLOCK();
+}
+
+#ifdef MEM_POOL_THREAD_SAFE
+static void _mem_tcache_key_init(void) {
+    pthread_key_create(&mem_tcache_key, _mem_tcache_exit);
+}
+
+// give back the objects in an exiting thread's caches, which no other
+// thread can use, rather than leave them until their pools are closed;
+// the store lock keeps the pools from being closed meanwhile
+static void _mem_tcache_exit(void *owner) {
+    (void) owner; /* the thread's own mem_tcache_owner */
+    MEM_STORE_LOCK();
+    while (mem_tcache_list != NULL) {
+        tcache_pt cache = mem_tcache_list;
+        mem_tcache_list = cache->thread_next;
+        if (cache->pool_mgr == NULL) {
+            free(cache);
+            continue;
+        }
+        for (unsigned i = 0; i < MEM_SLAB_NUM_CLASSES; ++i) {
+            _mem_tcache_flush(cache->pool_mgr, cache, i, cache->count[i]);
+        }
+        MEM_POOL_LOCK(cache->pool_mgr);
+        cache->owner = NULL;
+        MEM_POOL_UNLOCK(cache->pool_mgr);
+    }
+    MEM_STORE_UNLOCK();
+}
+#endif
+
+// mark every block free and off the remote free list; bits past the last
+// block stay clear
+static void _mem_fixed_fill(pool_mgr_pt pool_mgr) {
+    unsigned num_blocks = pool_mgr->num_blocks;
+    memset(pool_mgr->remote_map, 0, (num_blocks + 63) / 64 * sizeof(uint64_t));
+    for (unsigned i = 0; i < num_blocks / 64; ++i) {
+        pool_mgr->block_map[i] = ~(uint64_t) 0;
+    }
+    if (num_blocks % 64 != 0) {
+        pool_mgr->block_map[num_blocks / 64] = ((uint64_t) 1 << (num_blocks % 64)) - 1;
+    }
+}
+
+static int _mem_fixed_is_free(pool_mgr_pt pool_mgr, unsigned block) {
+    return (pool_mgr->block_map[block / 64] >> (block % 64)) & 1;
+}
+
+static void * _mem_fixed_alloc(pool_mgr_pt pool_mgr, size_t size, size_t alignment) {
+    if (size > pool_mgr->block_size) {
+        return NULL;
+    }
+
+    unsigned block;
+    if (pool_mgr->block_size % alignment == 0) {
+        // every block is aligned: the lowest free block, from the first
+        // word that has one
+        unsigned words = (pool_mgr->num_blocks + 63) / 64;
+        unsigned word = pool_mgr->block_hint;
+        while (word < words && pool_mgr->block_map[word] == 0) {
+            ++word;
+        }
+        pool_mgr->block_hint = word;
+        if (word == words) {
+            return NULL;
+        }
+        block = word * 64 + (unsigned) __builtin_ctzll(pool_mgr->block_map[word]);
+    } else {
+        // only every step-th block is aligned, the pool starts on a page
+        size_t step = alignment >> __builtin_ctzll((unsigned long long) pool_mgr->block_size);
+        for (block = 0; block < pool_mgr->num_blocks; block += (unsigned) step) {
+            if (_mem_fixed_is_free(pool_mgr, block)) {
+                break;
+            }
+        }
+        if (block >= pool_mgr->num_blocks) {
+            return NULL;
+        }
+    }
+    // other threads read the bitmap without the lock, see _mem_remote_free
+    __atomic_store_n(&pool_mgr->block_map[block / 64],
+                     pool_mgr->block_map[block / 64] & ~((uint64_t) 1 << (block % 64)),
+                     __ATOMIC_RELAXED);
+
+    // taking the block splits, shortens or removes a run of free blocks
+    int prev_free = block > 0 && _mem_fixed_is_free(pool_mgr, block - 1);
+    int next_free = block + 1 < pool_mgr->num_blocks && _mem_fixed_is_free(pool_mgr, block + 1);
+    if (prev_free && next_free) {
+        ++pool_mgr->pool.num_gaps;
+    } else if (!prev_free && !next_free) {
+        --pool_mgr->pool.num_gaps;
+    }
+
+    // update metadata (num_allocs, alloc_size); the whole block is taken
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size += pool_mgr->block_size;
+
+    return pool_mgr->pool.mem + (size_t) block * pool_mgr->block_size;
+}
+
+// the block in use that starts at alloc, num_blocks if none; a block on
+// the remote free list is as good as free
+static unsigned _mem_fixed_block(pool_mgr_pt pool_mgr, void *alloc) {
+    if ((char *) alloc < pool_mgr->pool.mem ||
+            (char *) alloc >= pool_mgr->pool.mem + pool_mgr->pool.total_size) {
+        return pool_mgr->num_blocks;
+    }
+    size_t offset = (size_t) ((char *) alloc - pool_mgr->pool.mem);
+    unsigned block = (unsigned) (offset / pool_mgr->block_size);
+    if (offset % pool_mgr->block_size != 0 || _mem_fixed_is_free(pool_mgr, block) ||
+            ((__atomic_load_n(&pool_mgr->remote_map[block / 64], __ATOMIC_RELAXED) >>
+              (block % 64)) & 1)) {
+        return pool_mgr->num_blocks;
+    }
+    return block;
+}
+
+static alloc_status _mem_fixed_free(pool_mgr_pt pool_mgr, void *alloc) {
+    // the address has to be the start of a block that is in use, and no
+    // remote free may have it; the block's bit in remote_map is the claim,
+    // as a node's is in _mem_node_claim
+    unsigned block = _mem_fixed_block(pool_mgr, alloc);
+    if (block == pool_mgr->num_blocks) {
+        return ALLOC_FAIL;
+    }
+    uint64_t bit = (uint64_t) 1 << (block % 64);
+    if (__atomic_fetch_or(&pool_mgr->remote_map[block / 64], bit, __ATOMIC_ACQ_REL) & bit) {
+        return ALLOC_FAIL;
+    }
+    _mem_fixed_release(pool_mgr, block);
+    __atomic_fetch_and(&pool_mgr->remote_map[block / 64], ~bit, __ATOMIC_RELEASE);
+    return ALLOC_OK;
+}
+
+// give a block back, with the claim on it held
+static void _mem_fixed_release(pool_mgr_pt pool_mgr, unsigned block) {
+    __atomic_store_n(&pool_mgr->block_map[block / 64],
+                     pool_mgr->block_map[block / 64] | ((uint64_t) 1 << (block % 64)),
+                     __ATOMIC_RELAXED);
+    if (block / 64 < pool_mgr->block_hint) {
+        pool_mgr->block_hint = block / 64;
+    }
+
+    // giving it back joins, extends or adds a run of free blocks
+    int prev_free = block > 0 && _mem_fixed_is_free(pool_mgr, block - 1);
+    int next_free = block + 1 < pool_mgr->num_blocks && _mem_fixed_is_free(pool_mgr, block + 1);
+    if (prev_free && next_free) {
+        --pool_mgr->pool.num_gaps;
+    } else if (!prev_free && !next_free) {
+        ++pool_mgr->pool.num_gaps;
+    }
+
+    // update metadata (num_allocs, alloc_size)
+    pool_mgr->pool.num_allocs -= 1;
+    pool_mgr->pool.alloc_size -= pool_mgr->block_size;
+}
+
+// one segment per allocated block and per run of free blocks
+static void _mem_fixed_inspect(pool_mgr_pt pool_mgr, pool_segment_pt segments) {
+    unsigned count = 0;
+    size_t run = 0;
+    for (unsigned block = 0; block < pool_mgr->num_blocks; ++block) {
+        if (_mem_fixed_is_free(pool_mgr, block)) {
+            run += pool_mgr->block_size;
+            continue;
+        }
+        if (run > 0) {
+            segments[count].size = run;
+            segments[count++].allocated = 0;
+            run = 0;
+        }
+        segments[count].size = pool_mgr->block_size;
+        segments[count++].allocated = 1;
+    }
+    if (run > 0) {
+        segments[count].size = run;
+        segments[count].allocated = 0;
+    }
+}
+
+// a mgr for a pool of general policy over size bytes at mem, which stays
+// the caller's to free if this fails; the mgr is not in the pool store
+static pool_mgr_pt _mem_pool_init(char *new_mem, size_t size, alloc_policy policy, unsigned flags) {
+    // allocate a new mem pool mgr
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+    // check success, on error return null
+    assert(new_pmgr);
+    if (new_pmgr == NULL) {
+        return NULL;
+    }
+    // set all parameters
+    new_pmgr->pool.mem = new_mem;   //mem holds size bytes
+    new_pmgr->pool.policy = policy;
+    new_pmgr->pool.total_size = size;
+    new_pmgr->pool.num_allocs = 0;  // no nodes have been allocated
+    new_pmgr->pool.num_gaps = 1;    // the entire thing is a gap
+    new_pmgr->pool.alloc_size = 0;  // pool has nothing allocated
+    // allocate a new node heap
+    node_pt new_nheap = (node_pt) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(node_t));
+    // check success, on error deallocate mgr and return null
+    assert(new_nheap);
+    if (new_nheap == NULL) {
+        free(new_pmgr);
+        new_pmgr = NULL;
+        return NULL;
+    }
+    // allocate a new gap index
+    gap_pt new_gapix = (gap_pt) calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
+    // check success, on error deallocate mgr/heap and return null
+    //assert(new_gapix);
+    if (new_gapix == NULL) {
+        free(new_pmgr);
+        new_pmgr = NULL;
+        free(new_nheap);
+        new_nheap = NULL;
+        return NULL;
+    }
+    // assign all the pointers and update meta data:
+    new_pmgr->node_heap[0].nodes = new_nheap;
+    new_pmgr->node_heap[0].capacity = MEM_NODE_HEAP_INIT_CAPACITY;
+    new_pmgr->num_chunks = 1;
+    new_pmgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+    new_pmgr->used_nodes = 1;     //just the 1 gap
+    new_pmgr->node_heap_top = 1;
+    new_pmgr->free_nodes = NULL;
+    new_pmgr->gap_ix = new_gapix;
+    new_pmgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+    new_pmgr->gap_ix_top = 0;
+    new_pmgr->gap_ix_free = MEM_GAP_IX_NIL;
+    new_pmgr->gap_root = MEM_GAP_IX_NIL;
+    new_pmgr->flags = flags;
+    new_pmgr->ff_len = 0;
+    new_pmgr->ff_hole = MEM_GAP_IX_NIL;
+    //   a FIRST_FIT pool also files its gaps in address order
+    if (policy == FIRST_FIT &&
+            _mem_resize_ff(new_pmgr, MEM_GAP_IX_INIT_CAPACITY) != ALLOC_OK) {
+        free(new_pmgr->ff_mem);
+        free(new_pmgr->ff_size);
+        free(new_pmgr->ff_node);
+        free(new_pmgr);
+        new_pmgr = NULL;
+        free(new_nheap);
+        new_nheap = NULL;
+        free(new_gapix);
+        new_gapix = NULL;
+        return NULL;
+    }
+
+    //   initialize top node of node heap
+    new_pmgr->head = &new_nheap[0];
+    new_pmgr->head->alloc_record.size = size;
+    new_pmgr->head->alloc_record.mem = new_mem;
+    new_pmgr->head->used = 1;
+    __atomic_store_n(&new_pmgr->head->allocated, 0, __ATOMIC_RELAXED);
+    new_pmgr->head->next = NULL;
+    new_pmgr->head->prev = NULL;
+    new_pmgr->rover = new_pmgr->head;
+    //   initialize top node of gap index (it counts the 1 gap again)
+    new_pmgr->pool.num_gaps = 0;
+    _mem_add_to_gap_ix(new_pmgr, size, new_pmgr->head);
+    //   a BUDDY pool starts out as its largest blocks
+    if (policy == BUDDY && _mem_buddy_init(new_pmgr) != ALLOC_OK) {
+        for (unsigned i = 0; i < new_pmgr->num_chunks; ++i) {
+            free(new_pmgr->node_heap[i].nodes);
+        }
+        free(new_pmgr->gap_ix);
+        free(new_pmgr);
+        return NULL;
+    }
+    //   a slab pool maps every slab granule, plus one for a partial tail
+    if (flags & POOL_SLAB) {
+        new_pmgr->slab_map = calloc(size / MEM_SLAB_SIZE + 1, sizeof(slab_pt));
+        if (new_pmgr->slab_map == NULL) {
+            for (unsigned i = 0; i < new_pmgr->num_chunks; ++i) {
+                free(new_pmgr->node_heap[i].nodes);
+            }
+            free(new_pmgr->ff_mem);
+            free(new_pmgr->ff_size);
+            free(new_pmgr->ff_node);
+            free(new_pmgr->gap_ix);
+            free(new_pmgr);
+            return NULL;
+        }
+    }
+
+    //   initialize pool mgr
+    MEM_POOL_LOCK_INIT(new_pmgr);
+    return new_pmgr;
+}
+
+static pool_pt _mem_bump_open(size_t size, unsigned flags) {
+    // allocate a new mem pool mgr and the pool
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+    if (new_pmgr == NULL) {
+        return NULL;
+    }
+    new_pmgr->flags = flags;
+    new_pmgr->pool.mem = (flags & POOL_MMAP) ? _mem_map_pool_mem(size, flags) : _mem_alloc_pool_mem(size);
+    if (new_pmgr->pool.mem == NULL) {
+        free(new_pmgr);
+        return NULL;
+    }
+    new_pmgr->pool.policy = BUMP;
+    new_pmgr->pool.total_size = size;
+    new_pmgr->pool.alloc_size = 0;  // pool has nothing allocated
+    new_pmgr->pool.num_allocs = 0;
+    new_pmgr->pool.num_gaps = 1;    // the entire thing is a gap
+    new_pmgr->gap_ix_free = MEM_GAP_IX_NIL;
+    new_pmgr->gap_root = MEM_GAP_IX_NIL;
+    new_pmgr->ff_hole = MEM_GAP_IX_NIL;
+    new_pmgr->bump_top = 0;
+    new_pmgr->bump_last = MEM_BUMP_NONE;
+
+    MEM_POOL_LOCK_INIT(new_pmgr);
+    //   link pool mgr to pool store
+    if (_mem_store_add(new_pmgr) != ALLOC_OK) {
+        mem_pool_close((pool_pt) new_pmgr);
+        return NULL;
+    }
+    // return the address of the mgr, cast to (pool_pt)
+    return (pool_pt)new_pmgr;
+}
+
+static void * _mem_bump_alloc(pool_mgr_pt pool_mgr, size_t size, size_t alignment) {
+    // skip ahead to an aligned address, the skipped bytes count as used
+    size_t top = pool_mgr->bump_top;
+    size_t pad = (size_t) (-(uintptr_t) (pool_mgr->pool.mem + top) & (alignment - 1));
+    if (pad > pool_mgr->pool.total_size - top ||
+            size > pool_mgr->pool.total_size - top - pad) {
+        return NULL;
+    }
+    pool_mgr->bump_last = top + pad;
+    pool_mgr->bump_top = top + pad + size;
+
+    // update metadata (num_allocs, alloc_size, num_gaps)
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size = pool_mgr->bump_top;
+    pool_mgr->pool.num_gaps = (pool_mgr->bump_top < pool_mgr->pool.total_size);
+
+    return pool_mgr->pool.mem + pool_mgr->bump_last;
+}
+
+static void * _mem_bump_realloc(pool_mgr_pt pool_mgr, void *alloc, size_t new_size) {
+    // an allocation starts below the offset, unless it is an empty last one
+    char *mem = (char *) alloc;
+    if (mem < pool_mgr->pool.mem || mem > pool_mgr->pool.mem + pool_mgr->bump_top) {
+        return NULL;
+    }
+    size_t offset = (size_t) (mem - pool_mgr->pool.mem);
+    if (offset == pool_mgr->bump_top && offset != pool_mgr->bump_last) {
+        return NULL;
+    }
+
+    // the last allocation ends at the offset, so it can move the offset
+    if (offset == pool_mgr->bump_last) {
+        if (new_size > pool_mgr->pool.total_size - offset) {
+            return NULL;
+        }
+        pool_mgr->bump_top = offset + new_size;
+        pool_mgr->pool.alloc_size = pool_mgr->bump_top;
+        pool_mgr->pool.num_gaps = (pool_mgr->bump_top < pool_mgr->pool.total_size);
+        return alloc;
+    }
+
+    // any other one is copied to a new allocation and left behind; its
+    // size is unknown, but it can't reach past the offset
+    size_t old_size = pool_mgr->bump_top - offset;
+    void *new_alloc = _mem_bump_alloc(pool_mgr, new_size, 1);
+    if (new_alloc == NULL) {
+        return NULL;
+    }
+    memcpy(new_alloc, alloc, (old_size < new_size) ? old_size : new_size);
+    pool_mgr->pool.num_allocs -= 1;
+    return new_alloc;
+}
+
+#ifdef MEM_POOL_THREAD_SAFE
+// leave alloc for the thread holding the pool's lock to free, without
+// waiting for the lock; ALLOC_FAIL if it cannot be checked without the lock
+// (slab objects, which a POOL_TCACHE pool caches instead) and must wait.
+// An allocation that is not in use, or that another free has claimed,
+// fails too, so the locked path reports the double free and the list
+// never links an allocation to itself.
+static alloc_status _mem_remote_free(pool_mgr_pt pool_mgr, void *alloc) {
+    pool_pt pool = &pool_mgr->pool;
+    if (pool->policy == FIXED) {
+        // a block has to hold the link, see _mem_remote_link
+        size_t offset = (size_t) ((char *) alloc - pool->mem);
+        if ((char *) alloc < pool->mem || offset >= pool->total_size ||
+                offset % pool_mgr->block_size != 0 ||
+                pool_mgr->block_size % sizeof(void *) != 0) {
+            return ALLOC_FAIL;
+        }
+        unsigned block = (unsigned) (offset / pool_mgr->block_size);
+        uint64_t bit = (uint64_t) 1 << (block % 64);
+        if (__atomic_fetch_or(&pool_mgr->remote_map[block / 64], bit, __ATOMIC_ACQ_REL) & bit) {
+            return ALLOC_FAIL;
+        }
+        if (__atomic_load_n(&pool_mgr->block_map[block / 64], __ATOMIC_RELAXED) & bit) {
+            __atomic_fetch_and(&pool_mgr->remote_map[block / 64], ~bit, __ATOMIC_RELEASE);
+            return ALLOC_FAIL;
+        }
+    } else {
+        if (pool->policy == BUMP ||
+                ((char *) alloc >= pool->mem && (char *) alloc < pool->mem + pool->total_size) ||
+                !_mem_node_heap_holds(pool_mgr, alloc)) {
+            return ALLOC_FAIL;
+        }
+        node_pt node = (node_pt) alloc;
+        unsigned expected = MEM_CLAIM_NONE;
+        if (!__atomic_compare_exchange_n(&node->claim, &expected, MEM_CLAIM_REMOTE, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return ALLOC_FAIL;
+        }
+        if (!__atomic_load_n(&node->allocated, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&node->claim, MEM_CLAIM_NONE, __ATOMIC_RELEASE);
+            return ALLOC_FAIL;
+        }
+    }
+
+    // push it onto the list; only the lock holder takes from it, and it
+    // takes the whole list, so a push cannot be confused by a pop
+    void **link = _mem_remote_link(pool_mgr, alloc);
+    void *head = __atomic_load_n(&pool_mgr->remote_frees, __ATOMIC_RELAXED);
+    do {
+        *link = head;
+    } while (!__atomic_compare_exchange_n(&pool_mgr->remote_frees, &head, alloc, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return ALLOC_OK;
+}
+
+// A free takes the node for itself before it marks it a gap, and gives it
+// up after, so that of two frees of one allocation only one succeeds, even
+// if one of them is a remote free that does not wait for the lock. The
+// lock holder already has the nodes it takes off the remote free list.
+// The remote free checks allocated after it has claimed the node, so it
+// sees a free that gave the node up before.
+static int _mem_node_claim(node_pt node) {
+    unsigned expected = MEM_CLAIM_NONE;
+    return __atomic_compare_exchange_n(&node->claim, &expected, MEM_CLAIM_LOCK, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) ||
+           expected == MEM_CLAIM_LOCK;
+}
+
+static void _mem_node_unclaim(node_pt node) {
+    __atomic_store_n(&node->claim, MEM_CLAIM_NONE, __ATOMIC_RELEASE);
+}
+
+// where the remote free list goes on from alloc: a handle's node has a
+// field for it, and a FIXED block, which is not in use any more, holds it
+static void ** _mem_remote_link(pool_mgr_pt pool_mgr, void *alloc) {
+    if (pool_mgr->pool.policy == FIXED) {
+        return (void **) alloc;
+    }
+    return &((node_pt) alloc)->remote_next;
+}
+
+// free what other threads left on the remote free list; called with the
+// lock held, it frees MEM_REMOTE_BATCH allocations at a time, so the gaps
+// of each batch are coalesced in one sweep. The remote frees have claimed
+// them, so these frees cannot fail; a FIXED block is freed at once.
+static void _mem_remote_drain(pool_mgr_pt pool_mgr) {
+    if (__atomic_load_n(&pool_mgr->remote_frees, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    void *alloc = __atomic_exchange_n(&pool_mgr->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    void *batch[MEM_REMOTE_BATCH];
+    size_t n = 0;
+    while (alloc != NULL) {
+        void *next = *_mem_remote_link(pool_mgr, alloc);
+        if (pool_mgr->pool.policy == FIXED) {
+            unsigned block = (unsigned) ((size_t) ((char *) alloc - pool_mgr->pool.mem) /
+                                         pool_mgr->block_size);
+            _mem_fixed_release(pool_mgr, block);
+            __atomic_fetch_and(&pool_mgr->remote_map[block / 64],
+                               ~((uint64_t) 1 << (block % 64)), __ATOMIC_RELEASE);
+        } else {
+            // the claim passes from the remote free to the lock holder
+            __atomic_store_n(&((node_pt) alloc)->claim, MEM_CLAIM_LOCK, __ATOMIC_RELAXED);
+            batch[n++] = alloc;
+        }
+        alloc = next;
+        if (n == MEM_REMOTE_BATCH || (alloc == NULL && n > 0)) {
+            _mem_del_alloc_batch(&pool_mgr->pool, batch, n);
+            n = 0;
+        }
+    }
+}
+#else
+// without threads the lock is never held by another, so nothing is left
+// on a remote free list, and a free always has the node to itself
+static alloc_status _mem_remote_free(pool_mgr_pt pool_mgr, void *alloc) {
+    (void) pool_mgr;
+    (void) alloc;
+    return ALLOC_FAIL;
+}
+
+static int _mem_node_claim(node_pt node) {
+    (void) node;
+    return 1;
+}
+
+static void _mem_node_unclaim(node_pt node) {
+    (void) node;
+}
+
+static void _mem_remote_drain(pool_mgr_pt pool_mgr) {
+    (void) pool_mgr;
+}
+#endif
+
+// a mgr for a pool of size bytes cut into num_shards shards, with room in
+// the shard array for capacity of them; the mgr is not in the pool store
+static pool_mgr_pt _mem_sharded_open(size_t size, alloc_policy policy,
+                                     unsigned num_shards, unsigned capacity) {
+    // allocate a new mem pool mgr, the pool and the shard array; the
+    // mgr itself has no node heap or gap index
+    pool_mgr_pt new_pmgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+    if (new_pmgr == NULL) {
+        return NULL;
+    }
+    new_pmgr->pool.mem = _mem_alloc_pool_mem(size);
+    new_pmgr->shards = calloc(capacity, sizeof(pool_mgr_pt));
+    if (new_pmgr->pool.mem == NULL || new_pmgr->shards == NULL) {
+        free(new_pmgr->pool.mem);
+        free(new_pmgr->shards);
+        free(new_pmgr);
+        return NULL;
+    }
+    new_pmgr->pool.policy = policy;
+    new_pmgr->pool.total_size = size;
+    new_pmgr->pool.alloc_size = 0;  // pool has nothing allocated
+    new_pmgr->pool.num_allocs = 0;
+    new_pmgr->pool.num_gaps = 0;    // the shards' gaps, counted below
+    new_pmgr->gap_ix_free = MEM_GAP_IX_NIL;
+    new_pmgr->gap_root = MEM_GAP_IX_NIL;
+    new_pmgr->ff_hole = MEM_GAP_IX_NIL;
+    MEM_POOL_LOCK_INIT(new_pmgr);
+
+    // cut the memory into page-aligned slices, the last one takes the rest
+    size_t shard_size = (size / num_shards) & ~(MEM_ALIGN_MAX - 1);
+    for (unsigned i = 0; i < num_shards; ++i) {
+        size_t offset = i * shard_size;
+        pool_mgr_pt shard = _mem_pool_init(new_pmgr->pool.mem + offset,
+                                           (i + 1 < num_shards) ? shard_size : size - offset,
+                                           policy, POOL_DEFAULT);
+        if (shard == NULL) {
+            mem_pool_close((pool_pt) new_pmgr);
+            return NULL;
+        }
+        shard->sharded = new_pmgr;
+        new_pmgr->shards[i] = shard;
+        new_pmgr->num_shards = i + 1;
+        new_pmgr->pool.num_gaps += shard->pool.num_gaps;
+    }
+    return new_pmgr;
+}
+
+// the shard a thread tries first: threads are numbered as they first use a
+// sharded pool, and spread over its shards round robin
+static unsigned _mem_shard_first(pool_mgr_pt pool_mgr) {
+    // the regions of a growable pool are tried in order, first fit
+    if (pool_mgr->max_size != 0) {
+        return 0;
+    }
+    if (mem_thread_id == 0) {
+        mem_thread_id = MEM_ATOMIC_ADD(mem_thread_count, 1);
+    }
+    return (mem_thread_id - 1) % pool_mgr->num_shards;
+}
+
+// carry a shard's change of metadata since before over to its pool, which
+// other shards update at the same time
+static void _mem_shard_sync(pool_mgr_pt pool_mgr, pool_mgr_pt shard, pool_t before) {
+    MEM_ATOMIC_ADD(pool_mgr->pool.num_allocs, shard->pool.num_allocs - before.num_allocs);
+    MEM_ATOMIC_ADD(pool_mgr->pool.alloc_size, shard->pool.alloc_size - before.alloc_size);
+    MEM_ATOMIC_ADD(pool_mgr->pool.num_gaps, shard->pool.num_gaps - before.num_gaps);
+}
+
+// the shard that alloc was allocated from: a handle is a node of one
+// shard's node heap, which can be told without the shard's lock. The
+// thread's own shard, where its allocations usually are, is asked first.
+static pool_mgr_pt _mem_shard_owner(pool_mgr_pt pool_mgr, void *alloc) {
+    unsigned first = _mem_shard_first(pool_mgr);
+    unsigned num_shards = __atomic_load_n(&pool_mgr->num_shards, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; i < num_shards; ++i) {
+        pool_mgr_pt shard = pool_mgr->shards[(first + i) % num_shards];
+        if (_mem_node_heap_holds(shard, alloc)) {
+            return shard;
+        }
+    }
+    return NULL;
+}
+
+// an allocation from the thread's shard, or else from the next one that
+// has room, or else from a new region of a growable pool; alignment 0 is
+// a plain allocation
+static void * _mem_sharded_alloc(pool_mgr_pt pool_mgr, size_t size, size_t alignment) {
+    unsigned first = _mem_shard_first(pool_mgr);
+    unsigned num_shards = __atomic_load_n(&pool_mgr->num_shards, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; ; ++i) {
+        if (i == num_shards) {
+            num_shards = _mem_grow(pool_mgr, num_shards, _mem_grow_need(pool_mgr, size, alignment));
+            if (i == num_shards) {
+                return NULL;
+            }
+        }
+        pool_mgr_pt shard = pool_mgr->shards[(first + i) % num_shards];
+        MEM_POOL_LOCK(shard);
+        pool_t before = shard->pool;
+        _mem_remote_drain(shard);
+        void *alloc = (alignment == 0) ?
+                _mem_new_alloc(&shard->pool, size) :
+                _mem_new_alloc_aligned(&shard->pool, size, alignment);
+        _mem_shard_sync(pool_mgr, shard, before);
+        MEM_POOL_UNLOCK(shard);
+        if (alloc != NULL) {
+            return alloc;
+        }
+    }
+}
 
-    return ALLOC_OK;
+// a batch is all or nothing, so it is made in one shard
+static alloc_status _mem_sharded_alloc_batch(pool_mgr_pt pool_mgr, const size_t *sizes, size_t n, void **out) {
+    unsigned first = _mem_shard_first(pool_mgr);
+    unsigned num_shards = __atomic_load_n(&pool_mgr->num_shards, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; ; ++i) {
+        if (i == num_shards) {
+            // a new region has to hold the whole batch
+            size_t need = 0;
+            for (size_t j = 0; j < n; ++j) {
+                size_t size_need = _mem_grow_need(pool_mgr, sizes[j], 0);
+                need = (size_need == 0 || need + size_need < need) ? SIZE_MAX : need + size_need;
+            }
+            num_shards = _mem_grow(pool_mgr, num_shards, need);
+            if (i == num_shards) {
+                return ALLOC_FAIL;
+            }
+        }
+        pool_mgr_pt shard = pool_mgr->shards[(first + i) % num_shards];
+        MEM_POOL_LOCK(shard);
+        pool_t before = shard->pool;
+        _mem_remote_drain(shard);
+        alloc_status status = _mem_new_alloc_batch(&shard->pool, sizes, n, out);
+        _mem_shard_sync(pool_mgr, shard, before);
+        MEM_POOL_UNLOCK(shard);
+        if (status == ALLOC_OK) {
+            return ALLOC_OK;
+        }
+    }
 }
 
-void mem_inspect_pool(pool_pt pool,
-                      pool_segment_pt *segments,
-                      unsigned *num_segments) {
-    // get the mgr from the pool
-    pool_mgr_pt new_pmgr = (pool_mgr_pt) pool;
+// the size of an empty region that surely holds an allocation of size
+// bytes at alignment (0 for none), 0 if there is no such size
+static size_t _mem_grow_need(pool_mgr_pt pool_mgr, size_t size, size_t alignment) {
+    if (pool_mgr->pool.policy == BUDDY) {
+        return _mem_buddy_block((size > alignment) ? size : alignment);
+    }
+    return (size + alignment < size) ? 0 : size + alignment;
+}
 
-    // allocate the segments array with size == used_nodes
-    pool_segment_pt new_seg_array = calloc(new_pmgr->used_nodes, sizeof(pool_segment_t));
-    if (new_seg_array == NULL) {
-        return;
+// the number of regions of a growable pool that found none of the seen
+// ones with room for need bytes: more than seen if another thread added
+// one meanwhile or a new one fits, else seen. A new region is twice the
+// size of the last, or more to hold need, but stays within max_size.
+static unsigned _mem_grow(pool_mgr_pt pool_mgr, unsigned seen, size_t need) {
+    if (pool_mgr->max_size == 0 || need == 0) {
+        return seen;
     }
-    
-    node_pt it = NULL;
-    
-    // Find first used node in node heap.
-    for (int i = 0; i < new_pmgr->total_nodes; ++i) {
-        if (new_pmgr->node_heap[i].used) {
-            it = &new_pmgr->node_heap[i];
-            break;
+    MEM_POOL_LOCK(pool_mgr);
+    unsigned num_shards = pool_mgr->num_shards;
+    if (num_shards > seen || num_shards == MEM_MAX_REGIONS) {
+        MEM_POOL_UNLOCK(pool_mgr);
+        return num_shards;
+    }
+    size_t room = pool_mgr->max_size;
+    for (unsigned i = 0; i < num_shards; ++i) {
+        room -= pool_mgr->shards[i]->pool.total_size;
+    }
+    size_t size = pool_mgr->shards[num_shards - 1]->pool.total_size;
+    do {
+        size = (size > room / 2) ? room : size * 2;
+    } while (size < need && size < room);
+    if (size < need) {
+        MEM_POOL_UNLOCK(pool_mgr);
+        return num_shards;
+    }
+
+    char *mem = _mem_alloc_pool_mem(size);
+    pool_mgr_pt region = (mem == NULL) ? NULL : _mem_pool_init(mem, size, pool_mgr->pool.policy, POOL_DEFAULT);
+    if (region == NULL) {
+        free(mem);
+        MEM_POOL_UNLOCK(pool_mgr);
+        return num_shards;
+    }
+    region->sharded = pool_mgr;
+    pool_mgr->shards[num_shards] = region;
+    MEM_ATOMIC_ADD(pool_mgr->pool.num_gaps, region->pool.num_gaps);
+    // the region is complete before other threads can see it
+    __atomic_store_n(&pool_mgr->num_shards, num_shards + 1, __ATOMIC_RELEASE);
+    MEM_POOL_UNLOCK(pool_mgr);
+    return num_shards + 1;
+}
+
+static void * _mem_sharded_realloc(pool_mgr_pt pool_mgr, void *alloc, size_t new_size) {
+    // like realloc(), no allocation means a new one
+    if (alloc == NULL) {
+        return _mem_sharded_alloc(pool_mgr, new_size, 0);
+    }
+    pool_mgr_pt shard = _mem_shard_owner(pool_mgr, alloc);
+    if (shard == NULL) {
+        return NULL;
+    }
+    MEM_POOL_LOCK(shard);
+    pool_t before = shard->pool;
+    _mem_remote_drain(shard);
+    // a freed handle is no allocation to resize or copy; one that is an
+    // allocation only fails to resize when the shard has no room
+    node_pt node = _mem_resolve_handle(shard, alloc);
+    if (node == NULL) {
+        _mem_shard_sync(pool_mgr, shard, before);
+        MEM_POOL_UNLOCK(shard);
+        return NULL;
+    }
+    size_t old_size = node->alloc_record.size;
+    void *new_alloc = _mem_realloc(&shard->pool, alloc, new_size);
+    _mem_shard_sync(pool_mgr, shard, before);
+    MEM_POOL_UNLOCK(shard);
+    if (new_alloc != NULL) {
+        return new_alloc;
+    }
+
+    // the shard has no room for the new size, the others may; the old
+    // allocation is the caller's, so it stays put without the lock
+    new_alloc = _mem_sharded_alloc(pool_mgr, new_size, 0);
+    if (new_alloc == NULL) {
+        return NULL;
+    }
+    memcpy(((node_pt) new_alloc)->alloc_record.mem, node->alloc_record.mem,
+           (old_size < new_size) ? old_size : new_size);
+    _mem_sharded_del(pool_mgr, alloc);
+    return new_alloc;
+}
+
+static alloc_status _mem_sharded_del(pool_mgr_pt pool_mgr, void *alloc) {
+    pool_mgr_pt shard = _mem_shard_owner(pool_mgr, alloc);
+    if (shard == NULL) {
+        return ALLOC_FAIL;
+    }
+    // a busy shard is left the allocation on its remote free list, as
+    // mem_del_alloc() does
+    if (!MEM_POOL_TRYLOCK(shard)) {
+        if (_mem_remote_free(shard, alloc) == ALLOC_OK) {
+            return ALLOC_OK;
         }
+        MEM_POOL_LOCK(shard);
     }
-    
-    // Traverse to the beginning of the heap
-    assert(it != NULL);
-    while (it->prev != NULL) {
-        it = it->prev;
+    pool_t before = shard->pool;
+    _mem_remote_drain(shard);
+    alloc_status status = _mem_del_alloc(&shard->pool, alloc);
+    _mem_shard_sync(pool_mgr, shard, before);
+    MEM_POOL_UNLOCK(shard);
+    return status;
+}
+
+static alloc_status _mem_sharded_reset(pool_mgr_pt pool_mgr) {
+    alloc_status status = ALLOC_OK;
+    unsigned num_shards = __atomic_load_n(&pool_mgr->num_shards, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; i < num_shards; ++i) {
+        pool_mgr_pt shard = pool_mgr->shards[i];
+        MEM_POOL_LOCK(shard);
+        pool_t before = shard->pool;
+        if (_mem_pool_reset(&shard->pool) != ALLOC_OK) {
+            status = ALLOC_FAIL;
+        }
+        _mem_shard_sync(pool_mgr, shard, before);
+        MEM_POOL_UNLOCK(shard);
     }
-    
-    for (int i = 0; i < new_pmgr->total_nodes; ++i) {
-        new_seg_array[i].size = it->alloc_record.size;
-        new_seg_array[i].allocated = it->allocated;
-        it = it->next;
-        if (it == NULL) {
-            break;
+    return status;
+}
+
+// the segments of the shards, or regions, are joined in their order
+static void _mem_sharded_inspect(pool_mgr_pt pool_mgr,
+                                 pool_segment_pt *segments,
+                                 unsigned *num_segments) {
+    pool_segment_pt all = NULL;
+    unsigned count = 0;
+    unsigned num_shards = __atomic_load_n(&pool_mgr->num_shards, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; i < num_shards; ++i) {
+        pool_mgr_pt shard = pool_mgr->shards[i];
+        pool_segment_pt shard_segments = NULL;
+        unsigned shard_count = 0;
+        MEM_POOL_LOCK(shard);
+        pool_t before = shard->pool;
+        _mem_remote_drain(shard);
+        _mem_shard_sync(pool_mgr, shard, before);
+        _mem_inspect_pool(&shard->pool, &shard_segments, &shard_count);
+        MEM_POOL_UNLOCK(shard);
+        if (shard_segments == NULL) {
+            free(all);
+            return;
+        }
+        pool_segment_pt joined = realloc(all, (count + shard_count) * sizeof(pool_segment_t));
+        if (joined == NULL) {
+            free(shard_segments);
+            free(all);
+            return;
         }
+        memcpy(joined + count, shard_segments, shard_count * sizeof(pool_segment_t));
+        free(shard_segments);
+        all = joined;
+        count += shard_count;
     }
-    
-    // "return" the values
-    *segments = new_seg_array;
-    *num_segments = new_pmgr->used_nodes;
+    *segments = all;
+    *num_segments = count;
 }
 
+static node_pt _mem_get_node(pool_mgr_pt pool_mgr) {
+    node_pt node = pool_mgr->free_nodes;
 
+    if (node != NULL) {
+        // reuse a released node
+        pool_mgr->free_nodes = node->next;
+    } else {
+        // take a fresh node from the top of the last chunk, adding a
+        // chunk if that one is used up
+        if (pool_mgr->node_heap_top ==
+                pool_mgr->node_heap[pool_mgr->num_chunks - 1].capacity &&
+                _mem_grow_node_heap(pool_mgr) != ALLOC_OK) {
+            return NULL;
+        }
+        node = &pool_mgr->node_heap[pool_mgr->num_chunks - 1].nodes[pool_mgr->node_heap_top++];
+    }
+
+    node->used = 1;
+#ifdef MEM_POOL_THREAD_SAFE
+    __atomic_store_n(&node->claim, MEM_CLAIM_NONE, __ATOMIC_RELAXED);
+#endif
+    node->next = NULL;
+    node->prev = NULL;
+    node->dirty = 0;
+    ++pool_mgr->used_nodes;
+    return node;
+}
+
+static void _mem_put_node(pool_mgr_pt pool_mgr, node_pt node) {
+    node->used = 0;
+    __atomic_store_n(&node->allocated, 0, __ATOMIC_RELAXED);
+    node->alloc_record.mem = NULL;
+    node->alloc_record.size = 0;
+    node->prev = NULL;
+    node->next = pool_mgr->free_nodes;
+    pool_mgr->free_nodes = node;
+    --pool_mgr->used_nodes;
+}
 
-/***********************************/
-/*                                 */
-/* Definitions of static functions */
-/*                                 */
-/***********************************/
 static alloc_status _mem_resize_pool_store() {
     // check if necessary
     // cast to float for accurate math with float const MEM_POOL_STORE_FILL_FACTOR
-    // using a cast to size_t, otherwise the float cannot fit in size_t
     if (((float) pool_store_size / pool_store_capacity) >= MEM_POOL_STORE_FILL_FACTOR) {
-        pool_store = realloc(pool_store, (size_t) (pool_store_capacity *
-                MEM_POOL_STORE_FILL_FACTOR * sizeof(pool_mgr_pt)));
-        pool_store_capacity = pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR;
+        unsigned capacity = pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR;
+        pool_mgr_pt *new_store = realloc(pool_store, capacity * sizeof(pool_mgr_pt));
+        if (new_store == NULL) {
+            return ALLOC_FAIL;
+        }
+        // the new slots are empty
+        memset(new_store + pool_store_capacity, 0,
+               (capacity - pool_store_capacity) * sizeof(pool_mgr_pt));
+        pool_store = new_store;
+        pool_store_capacity = capacity;
     }
     return ALLOC_OK;
 }
 
-static alloc_status _mem_resize_node_heap(pool_mgr_pt new_pmgr) {
-    
-    if (((float) new_pmgr->used_nodes / new_pmgr->total_nodes) >=
-            MEM_NODE_HEAP_FILL_FACTOR) {
-        
-        _mem_invalidate_gap_ix(new_pmgr);
-        new_pmgr->pool.num_gaps--;
-        
-        // allocate a new, expanded node heap
-        node_pt new_heap = calloc(new_pmgr->total_nodes *
-            MEM_NODE_HEAP_EXPAND_FACTOR, sizeof(node_t));
-        
-        node_pt it = new_pmgr->node_heap;
-        node_pt next = NULL;
-        for (int i = 0; it != NULL; i++) {
-            memcpy(&new_heap[i], it, sizeof(node_t));
-            //the mem changes?
-            
-            /*
-            printf("old heap record addr: %p, size: %d, mem_addr: %p\n",
-                   (void*) &it->alloc_record,
-                   (int) it->alloc_record.size,
-                   (void*) it->alloc_record.mem
-            );
-            
-            printf("new heap record addr: %p, size: %d, mem_addr: %p\n\n",
-               (void*) &new_heap[i].alloc_record,
-               (int) new_heap[i].alloc_record.size,
-               (void*) new_heap[i].alloc_record.mem
-            ); */
-            
-            new_heap[i].alloc_record = it->alloc_record; // crossing fingers
-            // Clear Old Data
-            /*
-            it->prev = NULL;
-            it->alloc_record.size = 0;
-            it->alloc_record.mem = NULL;
-            it->used = 0;
-            it->allocated = 0; */
-            //it->next = NULL;
-            
-            if (new_heap[i].allocated == 0) { // add gap to gap index
-                _mem_add_to_gap_ix(new_pmgr, new_heap[i].alloc_record.size, &new_heap[i]);
-            }
-            it = it->next; //todo zero out old memory?
-        }
-        
-        for (int i = 0; i < new_pmgr->used_nodes - 1; ++i) {
-            new_heap[i].next = &new_heap[i+1];
+// link the mgr to the first empty slot of the pool store, called by
+// concurrent opens, so under the store lock
+static alloc_status _mem_store_add(pool_mgr_pt pool_mgr) {
+    MEM_STORE_LOCK();
+    unsigned i = 0;
+    while (i < pool_store_size && pool_store[i] != NULL) {
+        ++i;
+    }
+    // none among the slots in use, take one more, expanding if necessary
+    if (i == pool_store_size) {
+        if (_mem_resize_pool_store() != ALLOC_OK) {
+            MEM_STORE_UNLOCK();
+            return ALLOC_FAIL;
         }
-        
-        for (int i = 1; i < new_pmgr->used_nodes; ++i) {
-            new_heap[i].prev = &new_heap[i-1];
+        ++pool_store_size;
+    }
+    pool_store[i] = pool_mgr;
+    // a new mgr may reuse the address of a closed one, the serial keeps
+    // threads from taking the closed pool's caches for its own
+    pool_mgr->serial = ++pool_serial;
+    MEM_STORE_UNLOCK();
+    return ALLOC_OK;
+}
+
+// unlink the mgr from the pool store; pool_store_size isn't decremented,
+// because it only grows
+static void _mem_store_remove(pool_mgr_pt pool_mgr) {
+    MEM_STORE_LOCK();
+    for (unsigned i = 0; i < pool_store_size; ++i) {
+        if (pool_store[i] == pool_mgr) {
+            pool_store[i] = NULL;
+            break;
         }
-        
-        // update the capacity of the node heap and the head node.
-        new_pmgr->total_nodes = new_pmgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR;
-        new_pmgr->node_heap = new_heap;
     }
+    MEM_STORE_UNLOCK();
+}
+
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
+    if (((float) pool_mgr->used_nodes / pool_mgr->total_nodes) >=
+            MEM_NODE_HEAP_FILL_FACTOR) {
+        return _mem_grow_node_heap(pool_mgr);
+    }
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_grow_node_heap(pool_mgr_pt pool_mgr) {
+    if (pool_mgr->num_chunks == MEM_NODE_HEAP_MAX_CHUNKS) {
+        return ALLOC_FAIL;
+    }
+
+    // add a chunk that grows the heap by the expand factor; nodes
+    // already in use stay where they are
+    unsigned capacity = pool_mgr->total_nodes * (MEM_NODE_HEAP_EXPAND_FACTOR - 1);
+    node_pt nodes = calloc(capacity, sizeof(node_t));
+    if (nodes == NULL) {
+        return ALLOC_FAIL;
+    }
+
+    // fresh nodes will come from the new chunk, so release the ones
+    // never handed out from the top of the current last chunk
+    node_chunk_pt last = &pool_mgr->node_heap[pool_mgr->num_chunks - 1];
+    while (pool_mgr->node_heap_top < last->capacity) {
+        node_pt node = &last->nodes[pool_mgr->node_heap_top++];
+        node->next = pool_mgr->free_nodes;
+        pool_mgr->free_nodes = node;
+    }
+
+    pool_mgr->node_heap[pool_mgr->num_chunks].nodes = nodes;
+    pool_mgr->node_heap[pool_mgr->num_chunks].capacity = capacity;
+    __atomic_store_n(&pool_mgr->num_chunks, pool_mgr->num_chunks + 1, __ATOMIC_RELEASE);
+    pool_mgr->total_nodes += capacity;
+    pool_mgr->node_heap_top = 0;
     return ALLOC_OK;
 }
 
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr) {
-    if (((float) pool_mgr->gap_ix->size / pool_mgr->gap_ix_capacity) >=
+    // slots are handed out from the top only when no released slot is
+    // left, so the top is the number of slots that are in use or recycled
+    if (((float) pool_mgr->gap_ix_top / pool_mgr->gap_ix_capacity) >=
             MEM_GAP_IX_FILL_FACTOR) {
-        pool_mgr->gap_ix = realloc(pool_mgr->gap_ix, (size_t) (pool_mgr->gap_ix_capacity *
-                                                               MEM_GAP_IX_EXPAND_FACTOR * sizeof(pool_mgr_pt)));
+        if (pool_mgr->ff_size != NULL &&
+                _mem_resize_ff(pool_mgr, pool_mgr->gap_ix_capacity *
+                                         MEM_GAP_IX_EXPAND_FACTOR) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+        gap_pt new_gap_ix = realloc(pool_mgr->gap_ix, pool_mgr->gap_ix_capacity *
+                                                      MEM_GAP_IX_EXPAND_FACTOR * sizeof(gap_t));
+        if (new_gap_ix == NULL) {
+            return ALLOC_FAIL;
+        }
+        // links are slot indices, so the tree survives the move
+        pool_mgr->gap_ix = new_gap_ix;
         pool_mgr->gap_ix_capacity = pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR;
     }
     return ALLOC_OK;
 }
 
+// order of the gap index: by size, ties broken by node address
+static int _mem_gap_cmp(size_t size, node_pt node, const gap_t *gap) {
+    if (size != gap->size) {
+        return (size < gap->size) ? -1 : 1;
+    }
+    if (node != gap->node) {
+        return ((uintptr_t) node < (uintptr_t) gap->node) ? -1 : 1;
+    }
+    return 0;
+}
+
+static unsigned _mem_gap_height(pool_mgr_pt pool_mgr, unsigned slot) {
+    return (slot == MEM_GAP_IX_NIL) ? 0 : pool_mgr->gap_ix[slot].height;
+}
+
+static void _mem_gap_update(pool_mgr_pt pool_mgr, unsigned slot) {
+    unsigned hl = _mem_gap_height(pool_mgr, pool_mgr->gap_ix[slot].left);
+    unsigned hr = _mem_gap_height(pool_mgr, pool_mgr->gap_ix[slot].right);
+    pool_mgr->gap_ix[slot].height = 1 + ((hl > hr) ? hl : hr);
+}
+
+static unsigned _mem_gap_rotate_right(pool_mgr_pt pool_mgr, unsigned slot) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    unsigned pivot = gap_ix[slot].left;
+    gap_ix[slot].left = gap_ix[pivot].right;
+    gap_ix[pivot].right = slot;
+    _mem_gap_update(pool_mgr, slot);
+    _mem_gap_update(pool_mgr, pivot);
+    return pivot;
+}
+
+static unsigned _mem_gap_rotate_left(pool_mgr_pt pool_mgr, unsigned slot) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    unsigned pivot = gap_ix[slot].right;
+    gap_ix[slot].right = gap_ix[pivot].left;
+    gap_ix[pivot].left = slot;
+    _mem_gap_update(pool_mgr, slot);
+    _mem_gap_update(pool_mgr, pivot);
+    return pivot;
+}
+
+// restore the AVL property at slot, returning the new subtree root
+static unsigned _mem_gap_balance(pool_mgr_pt pool_mgr, unsigned slot) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    _mem_gap_update(pool_mgr, slot);
+
+    int balance = (int) _mem_gap_height(pool_mgr, gap_ix[slot].left) -
+                  (int) _mem_gap_height(pool_mgr, gap_ix[slot].right);
+    if (balance > 1) {
+        unsigned left = gap_ix[slot].left;
+        if (_mem_gap_height(pool_mgr, gap_ix[left].left) <
+                _mem_gap_height(pool_mgr, gap_ix[left].right)) {
+            gap_ix[slot].left = _mem_gap_rotate_left(pool_mgr, left);
+        }
+        return _mem_gap_rotate_right(pool_mgr, slot);
+    }
+    if (balance < -1) {
+        unsigned right = gap_ix[slot].right;
+        if (_mem_gap_height(pool_mgr, gap_ix[right].right) <
+                _mem_gap_height(pool_mgr, gap_ix[right].left)) {
+            gap_ix[slot].right = _mem_gap_rotate_right(pool_mgr, right);
+        }
+        return _mem_gap_rotate_left(pool_mgr, slot);
+    }
+    return slot;
+}
+
+static unsigned _mem_gap_insert(pool_mgr_pt pool_mgr, unsigned root, unsigned slot) {
+    if (root == MEM_GAP_IX_NIL) {
+        return slot;
+    }
+    gap_pt gap = &pool_mgr->gap_ix[root];
+    if (_mem_gap_cmp(pool_mgr->gap_ix[slot].size,
+                     pool_mgr->gap_ix[slot].node, gap) < 0) {
+        unsigned left = _mem_gap_insert(pool_mgr, gap->left, slot);
+        pool_mgr->gap_ix[root].left = left;
+    } else {
+        unsigned right = _mem_gap_insert(pool_mgr, gap->right, slot);
+        pool_mgr->gap_ix[root].right = right;
+    }
+    return _mem_gap_balance(pool_mgr, root);
+}
+
+// unlink the leftmost slot of the subtree into *min
+static unsigned _mem_gap_remove_min(pool_mgr_pt pool_mgr, unsigned root, unsigned *min) {
+    if (pool_mgr->gap_ix[root].left == MEM_GAP_IX_NIL) {
+        *min = root;
+        return pool_mgr->gap_ix[root].right;
+    }
+    unsigned left = _mem_gap_remove_min(pool_mgr, pool_mgr->gap_ix[root].left, min);
+    pool_mgr->gap_ix[root].left = left;
+    return _mem_gap_balance(pool_mgr, root);
+}
+
+// unlink the slot keyed (size, node) into *removed (stays NIL if absent)
+static unsigned _mem_gap_delete(pool_mgr_pt pool_mgr, unsigned root,
+                                size_t size, node_pt node, unsigned *removed) {
+    if (root == MEM_GAP_IX_NIL) {
+        return MEM_GAP_IX_NIL;
+    }
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    int cmp = _mem_gap_cmp(size, node, &gap_ix[root]);
+    if (cmp < 0) {
+        gap_ix[root].left = _mem_gap_delete(pool_mgr, gap_ix[root].left, size, node, removed);
+    } else if (cmp > 0) {
+        gap_ix[root].right = _mem_gap_delete(pool_mgr, gap_ix[root].right, size, node, removed);
+    } else {
+        *removed = root;
+        unsigned left = gap_ix[root].left;
+        unsigned right = gap_ix[root].right;
+        if (right == MEM_GAP_IX_NIL) {
+            return left;
+        }
+        // the in-order successor takes the place of the removed slot
+        unsigned min = MEM_GAP_IX_NIL;
+        right = _mem_gap_remove_min(pool_mgr, right, &min);
+        gap_ix[min].left = left;
+        gap_ix[min].right = right;
+        return _mem_gap_balance(pool_mgr, min);
+    }
+    return _mem_gap_balance(pool_mgr, root);
+}
+
+// slot of the smallest gap that can hold size bytes, MEM_GAP_IX_NIL if none
+static unsigned _mem_find_gap_ix(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned found = MEM_GAP_IX_NIL;
+    unsigned slot = pool_mgr->gap_root;
+    while (slot != MEM_GAP_IX_NIL) {
+        if (size <= pool_mgr->gap_ix[slot].size) {
+            found = slot;
+            slot = pool_mgr->gap_ix[slot].left;
+        } else {
+            slot = pool_mgr->gap_ix[slot].right;
+        }
+    }
+    return found;
+}
+
+// TLSF_FIT size class of a gap of the given size
+static void _mem_tlsf_mapping(size_t size, unsigned *fl, unsigned *sl) {
+    if (size < MEM_TLSF_SL_COUNT) {
+        // small sizes get one class each
+        *fl = 0;
+        *sl = (unsigned) size;
+    } else {
+        unsigned msb = (unsigned) (63 - __builtin_clzll((unsigned long long) size));
+        *fl = msb - MEM_TLSF_SL_LOG2 + 1;
+        *sl = (unsigned) (size >> (msb - MEM_TLSF_SL_LOG2)) ^ MEM_TLSF_SL_COUNT;
+    }
+}
+
+static void _mem_tlsf_insert(pool_mgr_pt pool_mgr, unsigned slot) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    unsigned fl, sl;
+    _mem_tlsf_mapping(gap_ix[slot].size, &fl, &sl);
+
+    // push on the front of the class list
+    unsigned head = MEM_GAP_IX_NIL;
+    if (pool_mgr->tlsf_sl_bitmap[fl] & (1u << sl)) {
+        head = pool_mgr->tlsf_heads[fl][sl];
+        gap_ix[head].left = slot;
+    }
+    gap_ix[slot].left = MEM_GAP_IX_NIL;
+    gap_ix[slot].right = head;
+    pool_mgr->tlsf_heads[fl][sl] = slot;
+
+    pool_mgr->tlsf_sl_bitmap[fl] |= 1u << sl;
+    pool_mgr->tlsf_fl_bitmap |= (uint64_t) 1 << fl;
+}
+
+static void _mem_tlsf_remove(pool_mgr_pt pool_mgr, unsigned slot) {
+    gap_pt gap_ix = pool_mgr->gap_ix;
+    unsigned fl, sl;
+    _mem_tlsf_mapping(gap_ix[slot].size, &fl, &sl);
+
+    unsigned prev = gap_ix[slot].left;
+    unsigned next = gap_ix[slot].right;
+    if (next != MEM_GAP_IX_NIL) {
+        gap_ix[next].left = prev;
+    }
+    if (prev != MEM_GAP_IX_NIL) {
+        gap_ix[prev].right = next;
+    } else if (next != MEM_GAP_IX_NIL) {
+        pool_mgr->tlsf_heads[fl][sl] = next;
+    } else {
+        // the class list is now empty
+        pool_mgr->tlsf_sl_bitmap[fl] &= ~(1u << sl);
+        if (pool_mgr->tlsf_sl_bitmap[fl] == 0) {
+            pool_mgr->tlsf_fl_bitmap &= ~((uint64_t) 1 << fl);
+        }
+    }
+}
+
+// slot of a gap that can hold size bytes, MEM_GAP_IX_NIL if none
+static unsigned _mem_find_gap_tlsf(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned fl, sl;
+
+    // round the request up to the next class boundary, so that every
+    // gap in the class found below is large enough
+    size_t rounded = size;
+    if (size >= MEM_TLSF_SL_COUNT) {
+        unsigned msb = (unsigned) (63 - __builtin_clzll((unsigned long long) size));
+        size_t round = ((size_t) 1 << (msb - MEM_TLSF_SL_LOG2)) - 1;
+        if (size + round > size) {
+            rounded = size + round;
+        }
+    }
+    _mem_tlsf_mapping(rounded, &fl, &sl);
+
+    // first non-empty class at or above (fl, sl)
+    unsigned sl_map = pool_mgr->tlsf_sl_bitmap[fl] & (~0u << sl);
+    if (sl_map == 0) {
+        uint64_t fl_map = (fl + 1 < MEM_TLSF_FL_COUNT) ?
+                          pool_mgr->tlsf_fl_bitmap & (~(uint64_t) 0 << (fl + 1)) : 0;
+        if (fl_map != 0) {
+            fl = (unsigned) __builtin_ctzll(fl_map);
+            sl_map = pool_mgr->tlsf_sl_bitmap[fl];
+        }
+    }
+    if (sl_map != 0) {
+        sl = (unsigned) __builtin_ctz(sl_map);
+        return pool_mgr->tlsf_heads[fl][sl];
+    }
+
+    // no larger class has a gap, so only the request's own class may still
+    // hold one that fits; this happens whenever the classes above are
+    // empty, however long the list, so only its first few gaps are tried
+    _mem_tlsf_mapping(size, &fl, &sl);
+    if (pool_mgr->tlsf_sl_bitmap[fl] & (1u << sl)) {
+        unsigned slot = pool_mgr->tlsf_heads[fl][sl];
+        for (unsigned i = 0; i < MEM_TLSF_PROBES && slot != MEM_GAP_IX_NIL; ++i) {
+            if (size <= pool_mgr->gap_ix[slot].size) {
+                return slot;
+            }
+            slot = pool_mgr->gap_ix[slot].right;
+        }
+    }
+    return MEM_GAP_IX_NIL;
+}
+
+// the arrays may end up with different capacities if one realloc()
+// fails; each is stored as soon as it has moved, so all stay valid
+static alloc_status _mem_resize_ff(pool_mgr_pt pool_mgr, unsigned capacity) {
+    char **ff_mem = realloc(pool_mgr->ff_mem, capacity * sizeof(char *));
+    if (ff_mem == NULL) {
+        return ALLOC_FAIL;
+    }
+    pool_mgr->ff_mem = ff_mem;
+    size_t *ff_size = realloc(pool_mgr->ff_size, capacity * sizeof(size_t));
+    if (ff_size == NULL) {
+        return ALLOC_FAIL;
+    }
+    pool_mgr->ff_size = ff_size;
+    node_pt *ff_node = realloc(pool_mgr->ff_node, capacity * sizeof(node_pt));
+    if (ff_node == NULL) {
+        return ALLOC_FAIL;
+    }
+    pool_mgr->ff_node = ff_node;
+    return ALLOC_OK;
+}
+
+// position of the first entry at or above mem in the address-ordered
+// arrays; a hole repeats the address before it, so the order holds
+static unsigned _mem_ff_position(pool_mgr_pt pool_mgr, char *mem) {
+    unsigned lo = 0;
+    unsigned hi = pool_mgr->ff_len;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (pool_mgr->ff_mem[mid] < mem) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// move count entries of all three arrays from src to dst
+static void _mem_ff_move(pool_mgr_pt pool_mgr, unsigned dst, unsigned src, unsigned count) {
+    memmove(&pool_mgr->ff_mem[dst], &pool_mgr->ff_mem[src], count * sizeof(char *));
+    memmove(&pool_mgr->ff_size[dst], &pool_mgr->ff_size[src], count * sizeof(size_t));
+    memmove(&pool_mgr->ff_node[dst], &pool_mgr->ff_node[src], count * sizeof(node_pt));
+}
+
+static void _mem_ff_insert(pool_mgr_pt pool_mgr, size_t size, node_pt node) {
+    unsigned pos = _mem_ff_position(pool_mgr, node->alloc_record.mem);
+    unsigned hole = pool_mgr->ff_hole;
+
+    // only the entries between the insertion point and the hole (or the
+    // end, if there is none) move, so filling the hole costs nothing
+    if (hole == MEM_GAP_IX_NIL) {
+        _mem_ff_move(pool_mgr, pos + 1, pos, pool_mgr->ff_len - pos);
+        ++pool_mgr->ff_len;
+    } else if (pos <= hole) {
+        _mem_ff_move(pool_mgr, pos + 1, pos, hole - pos);
+    } else {
+        _mem_ff_move(pool_mgr, hole, hole + 1, pos - hole - 1);
+        --pos;
+    }
+    pool_mgr->ff_hole = MEM_GAP_IX_NIL;
+
+    pool_mgr->ff_mem[pos] = node->alloc_record.mem;
+    pool_mgr->ff_size[pos] = size;
+    pool_mgr->ff_node[pos] = node;
+}
+
+static alloc_status _mem_ff_remove(pool_mgr_pt pool_mgr, node_pt node) {
+    // a zero-byte gap (and the hole) can share the address of the gap
+    // after it, so look for the node among all entries at the address
+    char *mem = node->alloc_record.mem;
+    unsigned pos = _mem_ff_position(pool_mgr, mem);
+    while (pos < pool_mgr->ff_len && pool_mgr->ff_mem[pos] == mem &&
+           pool_mgr->ff_node[pos] != node) {
+        ++pos;
+    }
+    if (pos == pool_mgr->ff_len || pool_mgr->ff_node[pos] != node) {
+        return ALLOC_FAIL;
+    }
+
+    // close up an older hole first, there is room for one only
+    unsigned hole = pool_mgr->ff_hole;
+    if (hole != MEM_GAP_IX_NIL) {
+        _mem_ff_move(pool_mgr, hole, hole + 1, pool_mgr->ff_len - hole - 1);
+        --pool_mgr->ff_len;
+        if (pos > hole) {
+            --pos;
+        }
+    }
+
+    // leave a hole that never fits and keeps the addresses in order
+    pool_mgr->ff_mem[pos] = (pos > 0) ? pool_mgr->ff_mem[pos - 1] : pool_mgr->pool.mem;
+    pool_mgr->ff_size[pos] = 0;
+    pool_mgr->ff_node[pos] = NULL;
+    pool_mgr->ff_hole = pos;
+    return ALLOC_OK;
+}
+
+// position of the lowest gap that can hold size bytes, MEM_GAP_IX_NIL if none
+static unsigned _mem_find_gap_ff(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned pos = mem_scan_sizes(pool_mgr->ff_size, 0, pool_mgr->ff_len, size);
+    // a zero-byte request also fits the hole, which is no gap
+    if (pos == pool_mgr->ff_hole) {
+        pos = mem_scan_sizes(pool_mgr->ff_size, pos + 1, pool_mgr->ff_len, size);
+    }
+    return (pos < pool_mgr->ff_len) ? pos : MEM_GAP_IX_NIL;
+}
+
+// The scan kernels return the first position in [pos, len) whose size is
+// at least size, or len if there is none.
+static unsigned _mem_scan_sizes(const size_t *sizes, unsigned pos, unsigned len, size_t size) {
+    for (; pos < len; ++pos) {
+        if (size <= sizes[pos]) {
+            break;
+        }
+    }
+    return pos;
+}
+
+#ifdef MEM_SCAN_X86
+// There is no unsigned 64-bit compare below AVX-512, so both sides are
+// biased into signed range and size <= sizes[i] is tested as
+// sizes[i] > size - 1. A zero size fits anywhere and needs no vectors.
+__attribute__((target("sse4.2")))
+static unsigned _mem_scan_sizes_sse42(const size_t *sizes, unsigned pos, unsigned len, size_t size) {
+    if (size == 0) {
+        return _mem_scan_sizes(sizes, pos, len, size);
+    }
+    const __m128i bias = _mm_set1_epi64x(INT64_MIN);
+    const __m128i key = _mm_set1_epi64x((long long) ((size - 1) ^ (uint64_t) INT64_MIN));
+    for (; pos + 2 <= len; pos += 2) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &sizes[pos]), bias);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, key)));
+        if (mask != 0) {
+            return pos + (unsigned) __builtin_ctz((unsigned) mask);
+        }
+    }
+    return _mem_scan_sizes(sizes, pos, len, size);
+}
+
+__attribute__((target("avx2")))
+static unsigned _mem_scan_sizes_avx2(const size_t *sizes, unsigned pos, unsigned len, size_t size) {
+    if (size == 0) {
+        return _mem_scan_sizes(sizes, pos, len, size);
+    }
+    const __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i key = _mm256_set1_epi64x((long long) ((size - 1) ^ (uint64_t) INT64_MIN));
+    // eight sizes, one cache line, per round
+    for (; pos + 8 <= len; pos += 8) {
+        __m256i lo = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) &sizes[pos]), bias);
+        __m256i hi = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) &sizes[pos + 4]), bias);
+        __m256i fit_lo = _mm256_cmpgt_epi64(lo, key);
+        __m256i fit_hi = _mm256_cmpgt_epi64(hi, key);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(fit_lo)) |
+                   (_mm256_movemask_pd(_mm256_castsi256_pd(fit_hi)) << 4);
+        if (mask != 0) {
+            return pos + (unsigned) __builtin_ctz((unsigned) mask);
+        }
+    }
+    for (; pos + 4 <= len; pos += 4) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) &sizes[pos]), bias);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, key)));
+        if (mask != 0) {
+            return pos + (unsigned) __builtin_ctz((unsigned) mask);
+        }
+    }
+    return _mem_scan_sizes(sizes, pos, len, size);
+}
+#endif
+
 static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
                                        size_t size,
                                        node_pt node) {
-    // let the result be negative to start
-    alloc_status result = ALLOC_FAIL;
-    
-    // This is the boundary edge. Note: it seems the previous expectation
-    // was that _mem_resize_gap_ix could be called and that function would
-    // perform whatever check necessary instead of doing this boundary check
-    // here. I'm not sure of that though. (see the comment below)
-    if (pool_mgr->pool.num_gaps == pool_mgr->gap_ix_capacity) {
-        // expand the gap index, if necessary (call the function)
-        result = _mem_resize_gap_ix(pool_mgr);
-        // assert(result == ALLOC_OK);
-        if (result != ALLOC_OK) {
+    unsigned slot = pool_mgr->gap_ix_free;
+
+    if (slot != MEM_GAP_IX_NIL) {
+        // reuse a released slot
+        pool_mgr->gap_ix_free = pool_mgr->gap_ix[slot].left;
+    } else {
+        // take a fresh slot from the top, expanding the index if necessary
+        if (_mem_resize_gap_ix(pool_mgr) != ALLOC_OK) {
             return ALLOC_FAIL;
         }
+        slot = pool_mgr->gap_ix_top++;
     }
-    
-    // add the entry at the end
-    // clarity: gap_ix[pool_mgr->pool.num_gaps] should refer to
-    // the index just behind the last gap in the pool.
-    // Set size and pointer to the node of this gap node
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = size;
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = node;
+
+    // set size and pointer to the node of this gap node
+    gap_pt gap = &pool_mgr->gap_ix[slot];
+    gap->size = size;
+    gap->node = node;
+    gap->left = MEM_GAP_IX_NIL;
+    gap->right = MEM_GAP_IX_NIL;
+    gap->height = 1;
+    node->gap_slot = slot;
+
+    if (pool_mgr->pool.policy == TLSF_FIT || pool_mgr->pool.policy == BUDDY) {
+        // file it under its size class
+        _mem_tlsf_insert(pool_mgr, slot);
+    } else if (pool_mgr->pool.policy == FIRST_FIT) {
+        // file it in address order
+        _mem_ff_insert(pool_mgr, size, node);
+    } else {
+        // link it into the tree, which keeps the index in order
+        pool_mgr->gap_root = _mem_gap_insert(pool_mgr, pool_mgr->gap_root, slot);
+    }
+
     // update metadata (num_gaps)
     ++pool_mgr->pool.num_gaps;
-    
-    // sort the gap index (call the function)
-    result = _mem_sort_gap_ix(pool_mgr);
-    //assert(result == ALLOC_OK);
-    // check success
-    if (result != ALLOC_OK) {
-        return ALLOC_FAIL;
-    }
-    
-    return result;
+
+    return ALLOC_OK;
 }
 
 static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                             size_t size,
                                             node_pt node) {
     assert(pool_mgr->pool.num_gaps != 0);
-    // find the position of the node in the gap index, track that index
-    unsigned i;
-    for (i = 0; i < pool_mgr->pool.num_gaps; ++i) {
-        if (pool_mgr->gap_ix[i].node == node) {
-            break;
+
+    unsigned slot = MEM_GAP_IX_NIL;
+    if (pool_mgr->pool.policy == TLSF_FIT || pool_mgr->pool.policy == BUDDY) {
+        // the node knows its entry, so unlinking it is O(1)
+        slot = node->gap_slot;
+        if (slot >= pool_mgr->gap_ix_top || pool_mgr->gap_ix[slot].node != node) {
+            return ALLOC_FAIL;
+        }
+        _mem_tlsf_remove(pool_mgr, slot);
+    } else if (pool_mgr->pool.policy == FIRST_FIT) {
+        // find the gap by its address and take it out of the arrays
+        if (_mem_ff_remove(pool_mgr, node) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+        slot = node->gap_slot;
+    } else {
+        // find the entry by its key and unlink it from the tree
+        pool_mgr->gap_root = _mem_gap_delete(pool_mgr, pool_mgr->gap_root, size, node, &slot);
+        if (slot == MEM_GAP_IX_NIL) {
+            return ALLOC_FAIL;
         }
     }
-    // loop from there to the end of the array:
-    //     pull the entries (i.e. copy over) one position up
-    //     this effectively deletes the chosen node
-    while (i < pool_mgr->pool.num_gaps - 1) {
-        pool_mgr->gap_ix[i].size = pool_mgr->gap_ix[i+1].size;
-        pool_mgr->gap_ix[i].node = pool_mgr->gap_ix[i+1].node;
-        ++i;
-    }
+
+    // zero out the entry and put the slot on the free list
+    pool_mgr->gap_ix[slot].size = 0;
+    pool_mgr->gap_ix[slot].node = NULL;
+    pool_mgr->gap_ix[slot].left = pool_mgr->gap_ix_free;
+    pool_mgr->gap_ix_free = slot;
+
     // update metadata (num_gaps)
     --pool_mgr->pool.num_gaps;
-    
-    // zero out the element at position num_gaps!
-    pool_mgr->gap_ix[i].size = 0;
-    pool_mgr->gap_ix[i].node = NULL;
-    
-    // is there an ALLOC_FAIL case?
-    return ALLOC_OK;
-}
 
-// note: only called by _mem_add_to_gap_ix, which appends a single entry
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
-    // the new entry is at the end, so "bubble it up"
-    // loop from num_gaps - 1 until but not including 0:
-    for (int i = pool_mgr->pool.num_gaps - 1; i > 0; --i) {
-        /* if the size of the current entry is less than the previous (u - 1)
-         * or if the sizes are the same but the current entry points to a
-         * node with a lower address of pool allocation address (node)
-         * swap them (by copying) (remember to use a temporary variable)
-         */
-        if ((pool_mgr->gap_ix[i].size < pool_mgr->gap_ix[i-1].size)
-                || ((pool_mgr->gap_ix[i].size == pool_mgr->gap_ix[i-1].size)
-                && (pool_mgr->gap_ix[i].node <
-                pool_mgr->gap_ix[i-1].node))) {
-            gap_t tmp_gap = pool_mgr->gap_ix[i];
-            pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i-1];
-            pool_mgr->gap_ix[i-1] = tmp_gap;
-        }
-    }
     return ALLOC_OK;
 }
 
 static alloc_status _mem_invalidate_gap_ix(pool_mgr_pt pool_mgr) {
-    //create a gap_ix to work from, pointing to the gap_ix we're clearing
-    gap_pt new_gap = pool_mgr->gap_ix;
-
-    //iterate through gaps and clear the data and pointer
-    for (int i = 0; i < pool_mgr->pool.num_gaps; ++i) {
-        new_gap[i].node = NULL;
-        new_gap[i].size = 0;
-    }
+    // drop the whole tree at once; every slot becomes fresh again
+    pool_mgr->gap_root = MEM_GAP_IX_NIL;
+    pool_mgr->gap_ix_free = MEM_GAP_IX_NIL;
+    pool_mgr->gap_ix_top = 0;
+    pool_mgr->tlsf_fl_bitmap = 0;
+    memset(pool_mgr->tlsf_sl_bitmap, 0, sizeof(pool_mgr->tlsf_sl_bitmap));
+    pool_mgr->ff_len = 0;
+    pool_mgr->ff_hole = MEM_GAP_IX_NIL;
+    pool_mgr->pool.num_gaps = 0;
     return ALLOC_OK;
 }
-
@@ -7,7 +7,16 @@
 
 /* type declarations */
 
-typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
+typedef enum _alloc_policy { FIRST_FIT, BEST_FIT, TLSF_FIT, NEXT_FIT, BUDDY, FIXED, BUMP } alloc_policy;
+
+// options for mem_pool_open_ex, or-ed together
+typedef enum _pool_flags {
+    POOL_DEFAULT = 0,
+    POOL_SLAB    = 1 << 0, // serve allocations of up to 256 bytes from slabs
+    POOL_TCACHE  = 1 << 1, // POOL_SLAB, with a cache of slab objects per thread
+    POOL_MMAP    = 1 << 2, // map the pool memory, and give freed pages back
+    POOL_HUGE    = 1 << 3  // POOL_MMAP, in 2 MB pages where the system has them
+} pool_flags;
 
 typedef struct _pool {
     char *mem;
@@ -18,6 +27,19 @@ typedef struct _pool {
     unsigned num_gaps;
 } pool_t, *pool_pt;
 
+// position of a BUMP pool to go back to, see mem_pool_mark()
+typedef struct _pool_mark {
+    size_t offset;
+    unsigned num_allocs;
+} pool_mark_t;
+
+// bytes of address space a pool holds, and how many of them have memory,
+// see mem_pool_usage()
+typedef struct _pool_usage {
+    size_t reserved;
+    size_t committed;
+} pool_usage_t;
+
 typedef struct _pool_segment {
     size_t size;
     unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
@@ -41,15 +63,72 @@ mem_free();
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_ex(size_t size, alloc_policy policy, unsigned flags);
+
+pool_pt
+mem_pool_open_fixed(size_t block_size, unsigned num_blocks);
+
+pool_pt
+mem_pool_open_sharded(size_t size, alloc_policy policy, unsigned num_shards);
+
+pool_pt
+mem_pool_open_growable(size_t size, alloc_policy policy, size_t max_size);
+
+pool_pt
+mem_pool_open_file(const char *path, size_t size, alloc_policy policy);
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
+alloc_status
+mem_pool_close_force(pool_pt pool);
+
+alloc_status
+mem_pool_reset(pool_pt pool);
+
+alloc_status
+mem_pool_flush_cache(pool_pt pool);
+
+pool_mark_t
+mem_pool_mark(pool_pt pool);
+
+alloc_status
+mem_pool_rewind(pool_pt pool, pool_mark_t mark);
+
+alloc_status
+mem_pool_purge(pool_pt pool);
+
+pool_usage_t
+mem_pool_usage(pool_pt pool);
+
+alloc_status
+mem_pool_sync(pool_pt pool);
+
 void *
 mem_new_alloc(pool_pt pool, size_t size);
 
+void *
+mem_new_alloc_aligned(pool_pt pool, size_t size, size_t alignment);
+
+alloc_status
+mem_new_alloc_batch(pool_pt pool, const size_t *sizes, size_t n, void **out);
+
+void *
+mem_realloc(pool_pt pool, void *alloc, size_t new_size);
+
 alloc_status
 mem_del_alloc(pool_pt pool, void *alloc);
 
+alloc_status
+mem_del_alloc_batch(pool_pt pool, void **allocs, size_t n);
+
+void *
+mem_find_alloc(pool_pt pool, size_t offset);
+
+void *
+mem_alloc_mem(pool_pt pool, void *alloc);
+
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 #endif //C_MEM_POOL_H
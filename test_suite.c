@@ -2,14 +2,23 @@
 // Created by Ivo Georgiev on 3/3/16.
 //
 
+#define _POSIX_C_SOURCE 200809L // for setenv()
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
 #include "cmocka.h"
 
+#ifdef MEM_POOL_THREAD_SAFE
+#include <sched.h>
+#include <pthread.h>
+#endif
+#include <time.h>
+
 #include "mem_pool.h"
 #include "test_suite.h"
 
@@ -232,6 +241,33 @@ static void test_pool_nonempty(void **state) {
     assert_int_equal(status, ALLOC_OK);
 }
 
+static void test_pool_force_close(void **state) {
+    (void) state; /* unused */
+
+    unsigned pool_size = POOL_SIZE;
+    alloc_policy POOL_POLICY = FIRST_FIT;
+    pool_pt pool = NULL;
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) pool_size, (POOL_POLICY == FIRST_FIT) ? "FIRST_FIT" : "BEST_FIT");
+    pool = mem_pool_open(pool_size, POOL_POLICY);
+    assert_non_null(pool);
+
+    INFO("Allocating 100 bytes twice\n");
+    assert_non_null(mem_new_alloc(pool, 100));
+    assert_non_null(mem_new_alloc(pool, 100));
+
+    INFO("Force-closing pool without deallocating...\n");
+    status = mem_pool_close_force(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
 
 /*******************************************/
 /***       2. USER-FACING METADATA       ***/
@@ -1529,251 +1565,626 @@ static void test_pool_scenario10(void **state) {
     check_pool(pool, exp0);
 }
 
-/*******************************************/
-/***        4. BEST_FIT SCENARIOS        ***/
-/*******************************************/
-
-static int pool_bf_setup(void **state) {
-    alloc_status status;
-    const alloc_policy POOL_POLICY = BEST_FIT;
-    pool_pt pool = NULL;
+static void test_pool_scenario24(void **state) {
+    pool_pt pool = *state;
 
-    status = mem_init();
-    assert_int_equal(status, ALLOC_OK);
+    /*
+     * Scenario 24:
+     *
+     * 1. Allocate 20 x 100, deallocate every other one (10 gaps of 100
+     *    ahead of the rest of the pool, more than one search block).
+     * 2. Allocate 200 (no gap of 100 fits, it goes after the last one).
+     * 3. Deallocate the 11th 100 (merges into a gap of 300).
+     * 4. Allocate 250 (the merged gap is the first that fits).
+     * 5. Clean up.
+     */
 
-    INFO("Allocating pool of %lu bytes with policy %s\n",
-         (long) POOL_SIZE, (POOL_POLICY == FIRST_FIT) ? "FIRST_FIT" : "BEST_FIT");
-    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
-    assert_non_null(pool);
+    void * allocs[20];
+    for (int i = 0; i < 20; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    for (int i = 0; i < 20; i += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
 
-    *state = pool;
 
-    return 0;
-}
+    void * alloc0 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc0);
+    pool_segment_t exp0[22];
+    for (int i = 0; i < 20; ++i) {
+        exp0[i].size = 100;
+        exp0[i].allocated = (unsigned long) (i % 2);
+    }
+    exp0[20].size = 200;
+    exp0[20].allocated = 1;
+    exp0[21].size = pool->total_size - 2200;
+    exp0[21].allocated = 0;
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 1200, 11, 11);
 
-static int pool_bf_teardown(void **state) {
-    pool_pt pool = *state;
-    alloc_status status;
 
-    INFO("Closing pool\n");
-    status = mem_pool_close(pool);
-    assert_int_equal(status, ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[11]), ALLOC_OK);
+    void * alloc1 = mem_new_alloc(pool, 250);
+    assert_non_null(alloc1);
+    pool_segment_t exp1[21];
+    for (int i = 0; i < 10; ++i) {
+        exp1[i] = exp0[i];
+    }
+    exp1[10].size = 250;
+    exp1[10].allocated = 1;
+    exp1[11].size = 50;
+    exp1[11].allocated = 0;
+    for (int i = 12; i < 21; ++i) {
+        exp1[i] = exp0[i + 1];
+    }
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 1350, 11, 10);
 
-    status = mem_free();
-    assert_int_equal(status, ALLOC_OK);
 
-    return 0;
-}
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    for (int i = 1; i < 20; i += 2) {
+        if (i != 11) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        }
+    }
 
-static void dummy_test(void **state) {
-    (void) state;
+    pool_segment_t exp2[1] =
+            {
+                    {pool->total_size, 0}
+            };  // empty pool
+    check_pool(pool, exp2);
 }
 
-static void test_pool_scenario11(void **state) {
-    alloc_status status;
+static void test_pool_scenario26(void **state) {
     pool_pt pool = *state;
 
     /*
-     * Scenario 11:
+     * Scenario 26:
      *
-     * 1. Pool starts out as a single gap.
-     * 2. Allocate 100. That will be at the top. The rest is a gap.
-     * 3. Deallocate the 100 allocation. Pool is again one single gap.
+     * 1. Allocate 10.
+     * 2. Allocate 100 aligned to 64 (the 54 bytes of slack stay a gap).
+     * 3. Allocate 1000 aligned to 4096 (3932 bytes of slack).
+     * 4. Allocate 50 (first fit is the slack ahead of the 100).
+     * 5. Try alignments of 3, 4 and 8192 (should not succeed).
+     * 6. Clean up.
      */
 
-    pool_segment_t exp0[1] =
+    void * alloc0 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc_aligned(pool, 100, 64);
+    assert_non_null(alloc1);
+    pool_segment_t exp0[4] =
             {
-                    {pool->total_size, 0}
+                    {10, 1},
+                    {54, 0},
+                    {100, 1},
+                    {pool->total_size - 164, 0}
             };
     check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 110, 2, 2);
 
 
-    void * alloc0 = mem_new_alloc(pool, 100);
-    assert_non_null(alloc0);
-
-    pool_segment_t exp1[2] =
+    void * alloc2 = mem_new_alloc_aligned(pool, 1000, 4096);
+    assert_non_null(alloc2);
+    void * alloc3 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc3);
+    pool_segment_t exp1[7] =
             {
+                    {10, 1},
+                    {50, 1},
+                    {4, 0},
                     {100, 1},
-                    {pool->total_size-100, 0}
+                    {3932, 0},
+                    {1000, 1},
+                    {pool->total_size - 5096, 0}
             };
     check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 1160, 4, 3);
 
 
-    status = mem_del_alloc(pool, alloc0);
-    assert_int_equal(status, ALLOC_OK);
+    assert_null(mem_new_alloc_aligned(pool, 100, 3));
+    assert_null(mem_new_alloc_aligned(pool, 100, 4));
+    assert_null(mem_new_alloc_aligned(pool, 100, 8192));
 
-    check_pool(pool, exp0);
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    pool_segment_t exp2[1] =
+            {
+                    {pool->total_size, 0}
+            };  // empty pool
+    check_pool(pool, exp2);
 }
 
-static void test_pool_scenario12(void **state) {
-    alloc_status status;
+static void test_pool_scenario27(void **state) {
     pool_pt pool = *state;
 
     /*
-     * Scenario 12:
+     * Scenario 27:
      *
-     * 1. Pool starts out as a single gap.
-     * 2. Allocate 10 x 100.
-     * 3. Deallocate (1, 2), 4, (6, 7, 8)
-     * 4. Allocate 100.
-     * 5. Clean up.
+     * 1. Allocate 100 and 200.
+     * 2. Reallocate the 100 to 50 (in place, the tail becomes a gap).
+     * 3. Reallocate the 200 to 300 (in place, into the last gap).
+     * 4. Reallocate the 50 to 100 (in place, takes the whole gap).
+     * 5. Reallocate the 100 to 150 (moves to the last gap).
+     * 6. Clean up.
      */
 
-    pool_segment_t exp0[1] =
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+
+
+    assert_ptr_equal(mem_realloc(pool, alloc0, 50), alloc0);
+    pool_segment_t exp0[4] =
             {
-                    {pool->total_size, 0},
+                    {50, 1},
+                    {50, 0},
+                    {200, 1},
+                    {pool->total_size - 300, 0}
             };
     check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 250, 2, 2);
 
 
-    const unsigned NUM_ALLOCS = 10;
-
-    void * *allocs = (void * *) calloc(NUM_ALLOCS, sizeof(void *));
-    assert_non_null(allocs);
-
-    for (int i=0; i<NUM_ALLOCS; ++i) {
-        allocs[i] = mem_new_alloc(pool, 100);
-        assert_non_null(allocs[i]);
-    }
-    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
-
-    pool_segment_t exp1[8] =
+    assert_ptr_equal(mem_realloc(pool, alloc1, 300), alloc1);
+    pool_segment_t exp1[4] =
             {
-                    {100, 1},
-                    {200, 0},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {50, 1},
+                    {50, 0},
+                    {300, 1},
+                    {pool->total_size - 400, 0}
             };
     check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 350, 2, 2);
 
 
-    void * alloc0 = mem_new_alloc(pool, 100);
-    assert_non_null(alloc0);
-    pool_segment_t exp2[8] =
+    assert_ptr_equal(mem_realloc(pool, alloc0, 100), alloc0);
+    pool_segment_t exp2[3] =
             {
                     {100, 1},
-                    {200, 0},
-                    {100, 1},
-                    {100, 1},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {300, 1},
+                    {pool->total_size - 400, 0}
             };
     check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 400, 2, 1);
 
 
-    // clean up
-    for (int i=0; i<NUM_ALLOCS; ++i) {
-        if (allocs[i])
-            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
-    }
-    free(allocs);
-    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    void * alloc2 = mem_realloc(pool, alloc0, 150);
+    assert_non_null(alloc2);
+    pool_segment_t exp3[4] =
+            {
+                    {100, 0},
+                    {300, 1},
+                    {150, 1},
+                    {pool->total_size - 550, 0}
+            };
+    check_pool(pool, exp3);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 450, 2, 2);
 
 
-    check_pool(pool, exp0);
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    pool_segment_t exp4[1] =
+            {
+                    {pool->total_size, 0}
+            };  // empty pool
+    check_pool(pool, exp4);
 }
 
-static void test_pool_scenario13(void **state) {
-    alloc_status status;
+static void test_pool_scenario28(void **state) {
     pool_pt pool = *state;
 
     /*
-     * Scenario 13:
+     * Scenario 28:
      *
-     * 1. Pool starts out as a single gap.
-     * 2. Allocate 10 x 100.
-     * 3. Deallocate 1, 4, (6, 7, 8)
-     * 4. Allocate 100.
+     * 1. Allocate 100, 200, and 300.
+     * 2. Deallocate the 200.
+     * 3. Batch allocate 150, 50, and 400 (the 150 and 50 fill the gap).
+     * 4. Batch allocate 100 and the whole pool (fails, nothing is kept).
      * 5. Clean up.
      */
 
-    pool_segment_t exp0[1] =
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+
+    const size_t sizes0[3] = {150, 50, 400};
+    void * batch0[3];
+    assert_int_equal(mem_new_alloc_batch(pool, sizes0, 3, batch0), ALLOC_OK);
+    assert_non_null(batch0[0]);
+    assert_non_null(batch0[1]);
+    assert_non_null(batch0[2]);
+
+    pool_segment_t exp0[6] =
             {
-                    {pool->total_size, 0},
+                    {100, 1},
+                    {150, 1},
+                    {50, 1},
+                    {300, 1},
+                    {400, 1},
+                    {pool->total_size - 1000, 0}
             };
     check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 1000, 5, 1);
 
 
-    const unsigned NUM_ALLOCS = 10;
+    const size_t sizes1[2] = {100, POOL_SIZE};
+    void * batch1[2];
+    assert_int_equal(mem_new_alloc_batch(pool, sizes1, 2, batch1), ALLOC_FAIL);
+    assert_null(batch1[0]);
+    assert_null(batch1[1]);
 
-    void * *allocs = (void * *) calloc(NUM_ALLOCS, sizeof(void *));
-    assert_non_null(allocs);
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 1000, 5, 1);
 
-    for (int i=0; i<NUM_ALLOCS; ++i) {
-        allocs[i] = mem_new_alloc(pool, 100);
-        assert_non_null(allocs[i]);
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    for (unsigned i = 0; i < 3; ++i) {
+        assert_int_equal(mem_del_alloc(pool, batch0[i]), ALLOC_OK);
     }
-    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
 
-    pool_segment_t exp1[9] =
+    pool_segment_t exp1[1] =
             {
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
-            };
+                    {pool->total_size, 0}
+            };  // empty pool
     check_pool(pool, exp1);
+}
 
+static void test_pool_scenario29(void **state) {
+    pool_pt pool = *state;
 
-    void * alloc0 = mem_new_alloc(pool, 100);
-    assert_non_null(alloc0);
-    pool_segment_t exp2[9] =
+    /*
+     * Scenario 29:
+     *
+     * 1. Allocate 100, 200, 300, 400, and 500.
+     * 2. Batch deallocate the 200 and the 400.
+     * 3. Batch deallocate the 500, the 100, the 300, and the 100 again
+     *    (fails for the repeat, the rest merge into one gap).
+     * 4. Allocate 0, 0, and 16, and batch deallocate the two empty
+     *    allocations, the later one first (they merge into one empty gap).
+     */
+
+    void * allocs[5];
+    for (unsigned i = 0; i < 5; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100 * (i + 1));
+        assert_non_null(allocs[i]);
+    }
+
+
+    void * batch0[2] = {allocs[1], allocs[3]};
+    assert_int_equal(mem_del_alloc_batch(pool, batch0, 2), ALLOC_OK);
+
+    pool_segment_t exp0[6] =
             {
                     {100, 1},
-                    {100, 1},
-                    {100, 1},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {200, 0},
+                    {300, 1},
+                    {400, 0},
+                    {500, 1},
+                    {pool->total_size - 1500, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 900, 3, 3);
+
+
+    void * batch1[4] = {allocs[4], allocs[0], allocs[2], allocs[0]};
+    assert_int_equal(mem_del_alloc_batch(pool, batch1, 4), ALLOC_FAIL);
+
+    pool_segment_t exp1[1] =
+            {
+                    {pool->total_size, 0}
+            };  // empty pool
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+
+    void * empty0 = mem_new_alloc(pool, 0);
+    assert_non_null(empty0);
+    void * empty1 = mem_new_alloc(pool, 0);
+    assert_non_null(empty1);
+    void * alloc0 = mem_new_alloc(pool, 16);
+    assert_non_null(alloc0);
+    void * batch2[2] = {empty1, empty0};
+    assert_int_equal(mem_del_alloc_batch(pool, batch2, 2), ALLOC_OK);
+
+    pool_segment_t exp2[3] =
+            {
+                    {0, 0},
+                    {16, 1},
+                    {pool->total_size - 16, 0}
             };
     check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 16, 1, 2);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+}
+
+static void test_pool_scenario30(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 30:
+     *
+     * 1. Allocate 100, 200, and 300, and deallocate the 200.
+     * 2. Reset the pool (one gap, the old allocations are gone).
+     * 3. Allocate 400 (from the start of the pool).
+     * 4. Clean up.
+     */
+
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };  // empty pool
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+
+    void * alloc3 = mem_new_alloc(pool, 400);
+    assert_non_null(alloc3);
+    pool_segment_t exp1[2] =
+            {
+                    {400, 1},
+                    {pool->total_size - 400, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 400, 1, 1);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario38(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 38 (a zero-byte gap at the address of another gap):
+     *
+     * 1. Allocate 100, 0, 0, 50, 10.
+     * 2. Deallocate the 50 and the first 0 (two gaps start at 100).
+     * 3. Allocate 20 (from the 50) and 40 (after the 10).
+     * 4. Clean up.
+     */
+
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc2);
+    void * alloc3 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc3);
+    void * alloc4 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc4);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+
+    void * alloc5 = mem_new_alloc(pool, 20);
+    assert_non_null(alloc5);
+    void * alloc6 = mem_new_alloc(pool, 40);
+    assert_non_null(alloc6);
+    assert_ptr_not_equal(alloc5, alloc6);
+    pool_segment_t exp0[8] =
+            {
+                    {100, 1},
+                    {0, 0},
+                    {0, 1},
+                    {20, 1},
+                    {30, 0},
+                    {10, 1},
+                    {40, 1},
+                    {POOL_SIZE - 200, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 170, 5, 3);
 
 
     // clean up
-    for (int i=0; i<NUM_ALLOCS; ++i) {
-        if (allocs[i])
-            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
-    }
-    free(allocs);
     assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc6), ALLOC_OK);
+    pool_segment_t exp1[1] =
+            {
+                    {POOL_SIZE, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+static void test_pool_scenario41(void **state) {
+    (void) state; /* unused */
+
+    enum { MAX_GAPS = 20 };
+    const char *kernels[3] = { "scalar", "sse4.2", "avx2" };
+    unsigned num_kernels = 1;
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    num_kernels = __builtin_cpu_supports("avx2") ? 3 :
+                  __builtin_cpu_supports("sse4.2") ? 2 : 1;
+#endif
+
+    /*
+     * Scenario 41 (the FIRST_FIT search kernels agree):
+     *
+     * 1. For each kernel this CPU runs, and for 1 to 20 gaps of 48 bytes
+     *    between allocations of 16, one of them (or none) grown to 64:
+     * 2. Allocate 64 (it goes into the one gap of 64, or fails).
+     * 3. Every kernel picks the same gap, also where the number of gaps
+     *    is not a multiple of the kernel's width.
+     */
+
+    long found[3][MAX_GAPS + 1][MAX_GAPS + 1];
+    for (unsigned k = 0; k < num_kernels; ++k) {
+        assert_int_equal(setenv("MEM_POOL_SCAN", kernels[k], 1), 0);
+        assert_int_equal(mem_init(), ALLOC_OK);
+        for (unsigned num_gaps = 1; num_gaps <= MAX_GAPS; ++num_gaps) {
+            for (unsigned fit = 0; fit <= num_gaps; ++fit) {
+                pool_pt pool = mem_pool_open(4096, FIRST_FIT);
+                assert_non_null(pool);
+                void * gaps[MAX_GAPS];
+                void * fences[MAX_GAPS];
+                char * fit_mem = NULL;
+                for (unsigned i = 0; i < num_gaps; ++i) {
+                    gaps[i] = mem_new_alloc(pool, (i == fit) ? 64 : 48);
+                    assert_non_null(gaps[i]);
+                    fences[i] = mem_new_alloc(pool, 16);
+                    assert_non_null(fences[i]);
+                    if (i == fit) {
+                        fit_mem = mem_alloc_mem(pool, gaps[i]);
+                    }
+                }
+                void * rest = mem_new_alloc(pool, pool->total_size - pool->alloc_size);
+                assert_non_null(rest);
+                for (unsigned i = 0; i < num_gaps; ++i) {
+                    assert_int_equal(mem_del_alloc(pool, gaps[i]), ALLOC_OK);
+                }
+
+                void * alloc = mem_new_alloc(pool, 64);
+                if (fit == num_gaps) {
+                    assert_null(alloc);
+                    found[k][num_gaps][fit] = -1;
+                } else {
+                    assert_non_null(alloc);
+                    assert_ptr_equal(mem_alloc_mem(pool, alloc), fit_mem);
+                    found[k][num_gaps][fit] = (char *) fit_mem - pool->mem;
+                    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+                }
+                if (k > 0) {
+                    assert_int_equal(found[k][num_gaps][fit], found[0][num_gaps][fit]);
+                }
+
+                // clean up
+                for (unsigned i = 0; i < num_gaps; ++i) {
+                    assert_int_equal(mem_del_alloc(pool, fences[i]), ALLOC_OK);
+                }
+                assert_int_equal(mem_del_alloc(pool, rest), ALLOC_OK);
+                assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+            }
+        }
+        assert_int_equal(mem_free(), ALLOC_OK);
+    }
+    assert_int_equal(unsetenv("MEM_POOL_SCAN"), 0);
+}
+
+/*******************************************/
+/***        4. BEST_FIT SCENARIOS        ***/
+/*******************************************/
+
+static int pool_bf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = BEST_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, (POOL_POLICY == FIRST_FIT) ? "FIRST_FIT" : "BEST_FIT");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_bf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void dummy_test(void **state) {
+    (void) state;
+}
+
+static void test_pool_scenario11(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 11:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 100. That will be at the top. The rest is a gap.
+     * 3. Deallocate the 100 allocation. Pool is again one single gap.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+    check_pool(pool, exp0);
+
+
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+
+    pool_segment_t exp1[2] =
+            {
+                    {100, 1},
+                    {pool->total_size-100, 0}
+            };
+    check_pool(pool, exp1);
 
 
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_OK);
+
     check_pool(pool, exp0);
 }
 
-static void test_pool_scenario14(void **state) {
+static void test_pool_scenario12(void **state) {
     alloc_status status;
     pool_pt pool = *state;
 
     /*
-     * Scenario 14:
+     * Scenario 12:
      *
      * 1. Pool starts out as a single gap.
      * 2. Allocate 10 x 100.
-     * 3. Deallocate 4, 1, (6, 7, 8) (note: 4 before 1)
+     * 3. Deallocate (1, 2), 4, (6, 7, 8)
      * 4. Allocate 100.
      * 5. Clean up.
      */
@@ -1794,17 +2205,17 @@ static void test_pool_scenario14(void **state) {
         allocs[i] = mem_new_alloc(pool, 100);
         assert_non_null(allocs[i]);
     }
-    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
 
-    pool_segment_t exp1[9] =
+    pool_segment_t exp1[8] =
             {
                     {100, 1},
-                    {100, 0},
-                    {100, 1},
+                    {200, 0},
                     {100, 1},
                     {100, 0},
                     {100, 1},
@@ -1817,14 +2228,13 @@ static void test_pool_scenario14(void **state) {
 
     void * alloc0 = mem_new_alloc(pool, 100);
     assert_non_null(alloc0);
-    pool_segment_t exp2[9] =
+    pool_segment_t exp2[8] =
             {
                     {100, 1},
+                    {200, 0},
                     {100, 1},
                     {100, 1},
                     {100, 1},
-                    {100, 0},
-                    {100, 1},
                     {300, 0},
                     {100, 1},
                     {pool->total_size - 1000, 0},
@@ -1844,19 +2254,18 @@ static void test_pool_scenario14(void **state) {
     check_pool(pool, exp0);
 }
 
-static void test_pool_scenario15(void **state) {
+static void test_pool_scenario13(void **state) {
     alloc_status status;
     pool_pt pool = *state;
 
     /*
-     * Scenario 15:
+     * Scenario 13:
      *
      * 1. Pool starts out as a single gap.
      * 2. Allocate 10 x 100.
-     * 3. Deallocate (1, 2), 4, (6, 7, 8)
-     * 4. Allocate 50.
-     * 5. Allocate another 50.
-     * 6. Clean up.
+     * 3. Deallocate 1, 4, (6, 7, 8)
+     * 4. Allocate 100.
+     * 5. Clean up.
      */
 
     pool_segment_t exp0[1] =
@@ -1876,16 +2285,16 @@ static void test_pool_scenario15(void **state) {
         assert_non_null(allocs[i]);
     }
     assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
 
-    pool_segment_t exp1[8] =
+    pool_segment_t exp1[9] =
             {
                     {100, 1},
-                    {200, 0},
+                    {100, 0},
+                    {100, 1},
                     {100, 1},
                     {100, 0},
                     {100, 1},
@@ -1896,38 +2305,21 @@ static void test_pool_scenario15(void **state) {
     check_pool(pool, exp1);
 
 
-    void * alloc0 = mem_new_alloc(pool, 50);
+    void * alloc0 = mem_new_alloc(pool, 100);
     assert_non_null(alloc0);
     pool_segment_t exp2[9] =
             {
                     {100, 1},
-                    {200, 0},
-                    {100, 1},
-                    {50, 1},
-                    {50, 0},
-                    {100, 1},
-                    {300, 0},
                     {100, 1},
-                    {pool->total_size - 1000, 0},
-            };
-    check_pool(pool, exp2);
-
-
-    void * alloc1 = mem_new_alloc(pool, 50);
-    assert_non_null(alloc1);
-    pool_segment_t exp3[9] =
-            {
                     {100, 1},
-                    {200, 0},
                     {100, 1},
-                    {50, 1},
-                    {50, 1},
+                    {100, 0},
                     {100, 1},
                     {300, 0},
                     {100, 1},
                     {pool->total_size - 1000, 0},
             };
-    check_pool(pool, exp3);
+    check_pool(pool, exp2);
 
 
     // clean up
@@ -1937,25 +2329,23 @@ static void test_pool_scenario15(void **state) {
     }
     free(allocs);
     assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
-    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
 
 
     check_pool(pool, exp0);
 }
 
-static void test_pool_scenario16(void **state) {
+static void test_pool_scenario14(void **state) {
     alloc_status status;
     pool_pt pool = *state;
 
     /*
-     * Scenario 16:
+     * Scenario 14:
      *
      * 1. Pool starts out as a single gap.
      * 2. Allocate 10 x 100.
-     * 3. Deallocate 7, 5, 3, 1
-     * 4. Allocate 50.
-     * 5. Allocate another 50.
-     * 6. Clean up.
+     * 3. Deallocate 4, 1, (6, 7, 8) (note: 4 before 1)
+     * 4. Allocate 100.
+     * 5. Clean up.
      */
 
     pool_segment_t exp0[1] =
@@ -1974,12 +2364,192 @@ static void test_pool_scenario16(void **state) {
         allocs[i] = mem_new_alloc(pool, 100);
         assert_non_null(allocs[i]);
     }
-    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-
-    pool_segment_t exp1[11] =
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
+
+    pool_segment_t exp1[9] =
+            {
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    pool_segment_t exp2[9] =
+            {
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp2);
+
+
+    // clean up
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario15(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 15:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate (1, 2), 4, (6, 7, 8)
+     * 4. Allocate 50.
+     * 5. Allocate another 50.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    void * *allocs = (void * *) calloc(NUM_ALLOCS, sizeof(void *));
+    assert_non_null(allocs);
+
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
+
+    pool_segment_t exp1[8] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    void * alloc0 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc0);
+    pool_segment_t exp2[9] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {50, 1},
+                    {50, 0},
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp2);
+
+
+    void * alloc1 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc1);
+    pool_segment_t exp3[9] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {50, 1},
+                    {50, 1},
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp3);
+
+
+    // clean up
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario16(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 16:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate 7, 5, 3, 1
+     * 4. Allocate 50.
+     * 5. Allocate another 50.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    void * *allocs = (void * *) calloc(NUM_ALLOCS, sizeof(void *));
+    assert_non_null(allocs);
+
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+
+    pool_segment_t exp1[11] =
             {
                     {100, 1},
                     {100, 0},
@@ -2314,59 +2884,1502 @@ static void test_pool_scenario19(void **state) {
 }
 
 /*******************************************/
-/***        5. STRESS TESTING            ***/
+/***        5. TLSF_FIT SCENARIOS        ***/
 /*******************************************/
 
-void test_pool_stresstest0(void **state) {
-    (void) state; /* unused */
+static int pool_tlsf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = TLSF_FIT;
+    pool_pt pool = NULL;
 
-    const unsigned num_pools = 200;
-    const unsigned num_allocations = 1000; // 1000
-    const unsigned min_alloc_size = 10;
-    const unsigned pool_size =
-            (num_allocations / 2) *
-            (2 * min_alloc_size + (num_allocations - 1) * min_alloc_size);
-    assert_int_equal(pool_size, 5005000);
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "TLSF_FIT");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
 
+    *state = pool;
 
-    pool_pt pools[num_pools];
-    void *allocations[num_pools][num_allocations];
+    return 0;
+}
+
+static int pool_tlsf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario20(void **state) {
+    pool_pt pool = *state;
 
     /*
-     * Testing dynamic reallocation of pool structures:
+     * Scenario 20:
      *
-     * 1. 200 pools of 5005000 each (many pools)
-     * 2. In each pool 1000 allocations of different sizes (many allocations)
-     * 3. In each pool 500 deallocations (many gaps)
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 100, 1000, 10000.
+     * 3. Deallocate the 1000.
+     * 4. Allocate 500 (goes into the 1000 gap, whose class fits it).
+     * 5. Allocate the rest of the pool (exact fit).
+     * 6. Clean up.
      */
 
-    // initialize store
-    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_metadata(pool, TLSF_FIT, POOL_SIZE, 0, 0, 1);
 
-    // allocate pools
-    for (unsigned pix=0; pix < num_pools; ++pix) {
-        // open pool
-        pools[pix] =
-                mem_pool_open(pool_size, (pix % 2) ? FIRST_FIT : BEST_FIT);
-        assert_non_null(pools[pix]);
-        
-        // allocate pool
-        unsigned allocated = 0;
-        for (unsigned aix=0; aix < num_allocations; ++aix) {
-            allocations[pix][aix] =
-                    mem_new_alloc(pools[pix], (aix + 1) * min_alloc_size);
-            allocated += (aix + 1) * min_alloc_size;
-            if (!allocations[pix][aix]) {
-                INFO("ASSERT WILL FAIL at pix = %u, aix = %u, allocated = %u\n", pix, aix, allocated);
-            }
-            assert_non_null(allocations[pix][aix]);
-        }
 
-        // delete every other allocation
-        for (unsigned aix=0; aix < num_allocations; ++aix) {
-            if (aix % 2) {
-                assert_int_equal(
-                        mem_del_alloc(pools[pix], allocations[pix][aix]),
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 10000);
+    assert_non_null(alloc2);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    void * alloc3 = mem_new_alloc(pool, 500);
+    assert_non_null(alloc3);
+    pool_segment_t exp1[5] =
+            {
+                    {100, 1},
+                    {500, 1},
+                    {500, 0},
+                    {10000, 1},
+                    {pool->total_size - 11100, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, TLSF_FIT, POOL_SIZE, 10600, 3, 2);
+
+
+    void * alloc4 = mem_new_alloc(pool, pool->total_size - 11100);
+    assert_non_null(alloc4);
+    check_metadata(pool, TLSF_FIT, POOL_SIZE, POOL_SIZE - 500, 4, 1);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+/*******************************************/
+/***        6. NEXT_FIT SCENARIOS        ***/
+/*******************************************/
+
+static int pool_nf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = NEXT_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "NEXT_FIT");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_nf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario21(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 21:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 3 x 100.
+     * 3. Deallocate the first 100.
+     * 4. Allocate 50 (goes after the last allocation, not into the
+     *    gap at the front as FIRST_FIT would).
+     * 5. Allocate the rest of the pool.
+     * 6. Allocate 60 (the search wraps around to the front gap).
+     * 7. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_metadata(pool, NEXT_FIT, POOL_SIZE, 0, 0, 1);
+
+
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+    void * alloc3 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc3);
+    pool_segment_t exp1[5] =
+            {
+                    {100, 0},
+                    {100, 1},
+                    {100, 1},
+                    {50, 1},
+                    {pool->total_size - 350, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    void * alloc4 = mem_new_alloc(pool, pool->total_size - 350);
+    assert_non_null(alloc4);
+    void * alloc5 = mem_new_alloc(pool, 60);
+    assert_non_null(alloc5);
+    pool_segment_t exp2[6] =
+            {
+                    {60, 1},
+                    {40, 0},
+                    {100, 1},
+                    {100, 1},
+                    {50, 1},
+                    {pool->total_size - 350, 1},
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, NEXT_FIT, POOL_SIZE, POOL_SIZE - 40, 5, 1);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+/*******************************************/
+/***          7. BUDDY SCENARIOS         ***/
+/*******************************************/
+
+static int pool_buddy_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = BUDDY;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "BUDDY");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_buddy_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario22(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 22:
+     *
+     * 1. Pool starts out as its largest power of two blocks.
+     * 2. Allocate 100 (a 512 block is split down to 128).
+     * 3. Allocate 60 (takes the 64 block whole).
+     * 4. Allocate 100 (takes the buddy of the first 128).
+     * 5. Deallocate both 128s (they merge back into the 512).
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[7] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {512, 0},
+                    {64, 0},
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, BUDDY, POOL_SIZE, 0, 0, 7);
+
+
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 60);
+    assert_non_null(alloc1);
+    pool_segment_t exp1[9] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {128, 1},
+                    {128, 0},
+                    {256, 0},
+                    {64, 1},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, BUDDY, POOL_SIZE, 192, 2, 7);
+
+
+    void * alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    pool_segment_t exp2[9] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {128, 0},
+                    {128, 1},
+                    {256, 0},
+                    {64, 1},
+            };
+    check_pool(pool, exp2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    pool_segment_t exp3[7] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {512, 0},
+                    {64, 1},
+            };
+    check_pool(pool, exp3);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+/*******************************************/
+/***          8. SLAB SCENARIOS          ***/
+/*******************************************/
+
+static int pool_slab_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = FIRST_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s and slabs\n",
+         (long) POOL_SIZE, "FIRST_FIT");
+    pool = mem_pool_open_ex(POOL_SIZE, POOL_POLICY, POOL_SLAB);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_slab_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario23(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 23:
+     *
+     * 1. Allocate 10, 20 and 100 (one 4096 slab per size class).
+     * 2. Allocate 10 again (next object of the first slab).
+     * 3. Deallocate all (the slabs stay, metadata drops to zero).
+     * 4. Deallocate again and off an object boundary (should not succeed).
+     * 5. Allocate 257 x 16 (a second 16 byte slab), deallocate them
+     *    (the first slab empties while the second has free objects,
+     *    so it goes back to the pool).
+     * 6. Allocate 100 (a slab object, returned as its address), fill it,
+     *    and reallocate it to 300 (a node handle): mem_alloc_mem finds
+     *    the memory of both, and the contents moved with it.
+     * 7. Clean up (closing gives back the remaining slabs).
+     */
+
+    void * alloc0 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 20);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+    pool_segment_t exp0[4] =
+            {
+                    {4096, 1},
+                    {4096, 1},
+                    {4096, 1},
+                    {POOL_SIZE - 3 * 4096, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 130, 3, 1);
+
+
+    void * alloc3 = mem_new_alloc(pool, 10);
+    assert_ptr_equal(alloc3, (char *) alloc0 + 16);
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 140, 4, 1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc(pool, (char *) alloc2 + 1), ALLOC_FAIL);
+
+
+    void * allocs[257];
+    for (int i = 0; i < 257; ++i) {
+        allocs[i] = mem_new_alloc(pool, 16);
+        assert_non_null(allocs[i]);
+    }
+    pool_segment_t exp1[5] =
+            {
+                    {4096, 1},
+                    {4096, 1},
+                    {4096, 1},
+                    {4096, 1},
+                    {POOL_SIZE - 4 * 4096, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 257 * 16, 257, 1);
+
+    for (int i = 0; i < 257; ++i) {
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    pool_segment_t exp2[5] =
+            {
+                    {4096, 0},
+                    {4096, 1},
+                    {4096, 1},
+                    {4096, 1},
+                    {POOL_SIZE - 4 * 4096, 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 2);
+
+
+    void * alloc4 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc4);
+    assert_ptr_equal(mem_alloc_mem(pool, alloc4), alloc4);
+    memset(mem_alloc_mem(pool, alloc4), 0x5a, 100);
+    void * alloc5 = mem_realloc(pool, alloc4, 300);
+    assert_non_null(alloc5);
+    unsigned char * mem5 = mem_alloc_mem(pool, alloc5);
+    assert_ptr_not_equal(mem5, alloc5);
+    assert_true((char *) mem5 >= pool->mem &&
+                (char *) mem5 + 300 <= pool->mem + pool->total_size);
+    for (int i = 0; i < 100; ++i) {
+        assert_int_equal(mem5[i], 0x5a);
+    }
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 2);
+}
+
+static int pool_tcache_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = FIRST_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s and thread caches\n",
+         (long) POOL_SIZE, "FIRST_FIT");
+    pool = mem_pool_open_ex(POOL_SIZE, POOL_POLICY, POOL_TCACHE);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+#ifdef MEM_POOL_THREAD_SAFE
+static void * tcache_thread(void *arg) {
+    pool_pt pool = arg;
+    void * alloc = mem_new_alloc(pool, 10);
+    if (alloc != NULL) {
+        mem_del_alloc(pool, alloc);
+    }
+    return NULL;
+}
+#endif
+
+static void test_pool_scenario32(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 32:
+     *
+     * 1. Allocate 10 (the cache takes 16 objects of 16 bytes from a new
+     *    slab, all of them counted as allocated), then 10 again.
+     * 2. Deallocate the first, allocate 12 (the same object, from the cache).
+     * 3. Allocate 100 (16 objects of 128 bytes from a second slab).
+     * 4. Deallocate all (they stay in the cache, metadata is unchanged),
+     *    one of them again and off an object boundary (should not succeed).
+     * 5. Flush the cache (metadata drops to zero, the slabs stay), and
+     *    deallocate one of them again (should not succeed).
+     * 6. Allocate and deallocate 1000 (a regular allocation).
+     * 7. Open a BUMP pool with caches (should not succeed).
+     * 8. (thread-safe build) Allocate and deallocate 10 in a thread that
+     *    then exits (its cache is flushed).
+     * 9. Clean up (closing drains the cache of an object left in it).
+     */
+
+    void * alloc0 = mem_new_alloc(pool, 10);
+    assert_ptr_equal(alloc0, pool->mem);
+    void * alloc1 = mem_new_alloc(pool, 10);
+    assert_ptr_equal(alloc1, (char *) alloc0 + 16);
+    pool_segment_t exp0[2] =
+            {
+                    {4096, 1},
+                    {POOL_SIZE - 4096, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 16 * 16, 16, 1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    void * alloc2 = mem_new_alloc(pool, 12);
+    assert_ptr_equal(alloc2, alloc0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 16 * 16, 16, 1);
+
+
+    void * alloc3 = mem_new_alloc(pool, 100);
+    assert_ptr_equal(alloc3, pool->mem + 4096);
+    pool_segment_t exp1[3] =
+            {
+                    {4096, 1},
+                    {4096, 1},
+                    {POOL_SIZE - 2 * 4096, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 16 * 16 + 16 * 128, 32, 1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc(pool, (char *) alloc3 + 1), ALLOC_FAIL);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 16 * 16 + 16 * 128, 32, 1);
+
+
+    assert_int_equal(mem_pool_flush_cache(pool), ALLOC_OK);
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_FAIL);
+
+
+    void * alloc4 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc4);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 1000, 1, 1);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+
+    assert_null(mem_pool_open_ex(POOL_SIZE, BUMP, POOL_TCACHE));
+
+
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_t thread;
+    assert_int_equal(pthread_create(&thread, NULL, tcache_thread, pool), 0);
+    assert_int_equal(pthread_join(thread, NULL), 0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+#endif
+
+
+    void * alloc5 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc5);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+}
+
+/*******************************************/
+/***          9. FIXED SCENARIOS         ***/
+/*******************************************/
+
+static const size_t FIXED_BLOCK_SIZE    = 64;
+static const unsigned FIXED_NUM_BLOCKS  = 100;
+
+static int pool_fixed_setup(void **state) {
+    alloc_status status;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %u blocks of %lu bytes\n",
+         FIXED_NUM_BLOCKS, (long) FIXED_BLOCK_SIZE);
+    pool = mem_pool_open_fixed(FIXED_BLOCK_SIZE, FIXED_NUM_BLOCKS);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_fixed_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario25(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 25:
+     *
+     * 1. Pool is a gap of 100 blocks of 64.
+     * 2. Allocate 64, 10 and 64 (a block each, in address order).
+     * 3. Allocate 65 (should not succeed).
+     * 4. Deallocate the middle block, then again (should not succeed).
+     * 5. Allocate 32 (takes the lowest free block).
+     * 6. Allocate the rest, then one more (should not succeed).
+     * 7. Clean up.
+     */
+
+    const size_t POOL_BYTES = FIXED_BLOCK_SIZE * FIXED_NUM_BLOCKS;
+
+    pool_segment_t exp0[1] =
+            {
+                    {POOL_BYTES, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIXED, POOL_BYTES, 0, 0, 1);
+
+
+    void * alloc0 = mem_new_alloc(pool, 64);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 10);
+    assert_ptr_equal(alloc1, (char *) alloc0 + 64);
+    void * alloc2 = mem_new_alloc(pool, 64);
+    assert_ptr_equal(alloc2, (char *) alloc0 + 128);
+    pool_segment_t exp1[4] =
+            {
+                    {64, 1},
+                    {64, 1},
+                    {64, 1},
+                    {POOL_BYTES - 192, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIXED, POOL_BYTES, 192, 3, 1);
+
+    assert_null(mem_new_alloc(pool, 65));
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc(pool, (char *) alloc0 + 1), ALLOC_FAIL);
+    pool_segment_t exp2[4] =
+            {
+                    {64, 1},
+                    {64, 0},
+                    {64, 1},
+                    {POOL_BYTES - 192, 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, FIXED, POOL_BYTES, 128, 2, 2);
+
+
+    alloc1 = mem_new_alloc(pool, 32);
+    assert_ptr_equal(alloc1, (char *) alloc0 + 64);
+    check_pool(pool, exp1);
+
+
+    void * rest[97];
+    for (int i = 0; i < 97; ++i) {
+        rest[i] = mem_new_alloc(pool, FIXED_BLOCK_SIZE);
+        assert_non_null(rest[i]);
+    }
+    check_metadata(pool, FIXED, POOL_BYTES, POOL_BYTES, 100, 0);
+    assert_null(mem_new_alloc(pool, 1));
+
+
+    // clean up
+    for (int i = 0; i < 97; ++i) {
+        assert_int_equal(mem_del_alloc(pool, rest[i]), ALLOC_OK);
+    }
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    check_pool(pool, exp0);
+    check_metadata(pool, FIXED, POOL_BYTES, 0, 0, 1);
+}
+
+/*******************************************/
+/***          10. BUMP SCENARIOS         ***/
+/*******************************************/
+
+static int pool_bump_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = BUMP;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "BUMP");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_bump_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario31(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 31:
+     *
+     * 1. Allocate 100 and 200 (one after the other).
+     * 2. Deallocate the 100 (fails, bump allocations aren't freed).
+     * 3. Mark the pool, then allocate 300 and 400.
+     * 4. Rewind to the mark (the 300 and 400 are gone).
+     * 5. Allocate 50 (where the 300 was).
+     * 6. Batch allocate 100 and the whole pool (fails, nothing is kept,
+     *    and the 50 can still grow in place).
+     * 7. Reallocate the address right past the last allocation (fails,
+     *    it is no allocation).
+     * 8. Reset the pool.
+     */
+
+    char * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    char * alloc1 = mem_new_alloc(pool, 200);
+    assert_ptr_equal(alloc1, alloc0 + 100);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_FAIL);
+
+    pool_segment_t exp0[2] =
+            {
+                    {300, 1},
+                    {pool->total_size - 300, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, BUMP, POOL_SIZE, 300, 2, 1);
+
+
+    pool_mark_t mark = mem_pool_mark(pool);
+    char * alloc2 = mem_new_alloc(pool, 300);
+    assert_ptr_equal(alloc2, alloc0 + 300);
+    assert_non_null(mem_new_alloc(pool, 400));
+
+    pool_segment_t exp1[2] =
+            {
+                    {1000, 1},
+                    {pool->total_size - 1000, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, BUMP, POOL_SIZE, 1000, 4, 1);
+
+
+    assert_int_equal(mem_pool_rewind(pool, mark), ALLOC_OK);
+    check_pool(pool, exp0);
+    check_metadata(pool, BUMP, POOL_SIZE, 300, 2, 1);
+
+
+    assert_ptr_equal(mem_new_alloc(pool, 50), alloc2);
+    check_metadata(pool, BUMP, POOL_SIZE, 350, 3, 1);
+
+
+    const size_t sizes0[2] = {100, POOL_SIZE};
+    void * batch0[2];
+    assert_int_equal(mem_new_alloc_batch(pool, sizes0, 2, batch0), ALLOC_FAIL);
+    assert_null(batch0[0]);
+    assert_null(batch0[1]);
+    check_metadata(pool, BUMP, POOL_SIZE, 350, 3, 1);
+    assert_ptr_equal(mem_realloc(pool, alloc2, 60), alloc2);
+    check_metadata(pool, BUMP, POOL_SIZE, 360, 3, 1);
+
+
+    assert_null(mem_realloc(pool, alloc2 + 60, 10));
+    check_metadata(pool, BUMP, POOL_SIZE, 360, 3, 1);
+
+
+    // clean up
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+
+    pool_segment_t exp2[1] =
+            {
+                    {pool->total_size, 0}
+            };  // empty pool
+    check_pool(pool, exp2);
+    check_metadata(pool, BUMP, POOL_SIZE, 0, 0, 1);
+}
+
+/*******************************************/
+/***        11. SHARDED SCENARIOS        ***/
+/*******************************************/
+
+// 4 shards of the pool, on page boundaries; the last one takes the rest
+static const unsigned SHARD_NUM            = 4;
+static const size_t SHARD_SIZE              = 249856;
+static const size_t SHARD_LAST_SIZE         = POOL_SIZE - 3 * SHARD_SIZE;
+
+static int pool_sharded_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = FIRST_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s in %u shards\n",
+         (long) POOL_SIZE, "FIRST_FIT", SHARD_NUM);
+    pool = mem_pool_open_sharded(POOL_SIZE, POOL_POLICY, SHARD_NUM);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_sharded_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario33(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 33 (this thread is the first to use a sharded pool, so
+     * it allocates from the first shard):
+     *
+     * 1. Allocate 100 (from the first shard).
+     * 2. Allocate the rest of the first shard.
+     * 3. Allocate 1000 (the first shard is full, so from the second).
+     * 4. Reallocate the 100 to 200 (no room in the first shard, so it
+     *    moves to the second).
+     * 5. Reallocate the old handle of the 100 (should not succeed, and
+     *    should not allocate anything).
+     * 6. Deallocate all (each goes back to its shard).
+     * 7. Open sharded FIXED and BUMP pools, and pools with no shards or
+     *    shards of less than a page (should not succeed).
+     */
+
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    pool_segment_t exp0[5] =
+            {
+                    {100, 1},
+                    {SHARD_SIZE - 100, 0},
+                    {SHARD_SIZE, 0},
+                    {SHARD_SIZE, 0},
+                    {SHARD_LAST_SIZE, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100, 1, 4);
+
+
+    void * alloc1 = mem_new_alloc(pool, SHARD_SIZE - 100);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc2);
+    pool_segment_t exp1[6] =
+            {
+                    {100, 1},
+                    {SHARD_SIZE - 100, 1},
+                    {1000, 1},
+                    {SHARD_SIZE - 1000, 0},
+                    {SHARD_SIZE, 0},
+                    {SHARD_LAST_SIZE, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, SHARD_SIZE + 1000, 3, 3);
+
+
+    void * alloc3 = mem_realloc(pool, alloc0, 200);
+    assert_non_null(alloc3);
+    pool_segment_t exp2[7] =
+            {
+                    {100, 0},
+                    {SHARD_SIZE - 100, 1},
+                    {1000, 1},
+                    {200, 1},
+                    {SHARD_SIZE - 1200, 0},
+                    {SHARD_SIZE, 0},
+                    {SHARD_LAST_SIZE, 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, SHARD_SIZE + 1100, 3, 4);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_FAIL);
+    assert_null(mem_realloc(pool, alloc0, 300));
+    check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, SHARD_SIZE + 1100, 3, 4);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    pool_segment_t exp3[4] =
+            {
+                    {SHARD_SIZE, 0},
+                    {SHARD_SIZE, 0},
+                    {SHARD_SIZE, 0},
+                    {SHARD_LAST_SIZE, 0}
+            };
+    check_pool(pool, exp3);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 4);
+
+
+    assert_null(mem_pool_open_sharded(POOL_SIZE, FIXED, SHARD_NUM));
+    assert_null(mem_pool_open_sharded(POOL_SIZE, BUMP, SHARD_NUM));
+    assert_null(mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, 0));
+    assert_null(mem_pool_open_sharded(4096, FIRST_FIT, 2));
+}
+
+// a growable pool starts with one region and may add up to three times as much
+static const size_t GROW_SIZE               = 100000;
+static const size_t GROW_MAX_SIZE           = 400000;
+
+static int pool_growable_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = FIRST_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating growable pool of %lu bytes, up to %lu, with policy %s\n",
+         (long) GROW_SIZE, (long) GROW_MAX_SIZE, "FIRST_FIT");
+    pool = mem_pool_open_growable(GROW_SIZE, POOL_POLICY, GROW_MAX_SIZE);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static void test_pool_scenario34(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 34:
+     *
+     * 1. Allocate 60000 (from the first region).
+     * 2. Allocate 60000 (no room, so the pool adds a region of twice the
+     *    size of the first).
+     * 3. Allocate 150000 (a new region would pass the maximum size, so
+     *    should not succeed).
+     * 4. Allocate 90000 (from the second region).
+     * 5. Allocate 80000 (the pool adds a last region, cut to the maximum
+     *    size).
+     * 6. Allocate 30000 (from the first region).
+     * 7. Allocate 60000 (the pool is at its maximum size, so should not
+     *    succeed).
+     * 8. Write all allocations through mem_alloc_mem (the later regions
+     *    are not in the first one's memory).
+     * 9. Deallocate all (the regions stay).
+     * 10. Open growable FIXED and BUMP pools, and pools with a maximum
+     *     size below the size or of less than a page (should not succeed).
+     */
+
+    void * alloc0 = mem_new_alloc(pool, 60000);
+    assert_non_null(alloc0);
+    pool_segment_t exp0[2] =
+            {
+                    {60000, 1},
+                    {40000, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, GROW_SIZE, 60000, 1, 1);
+
+
+    void * alloc1 = mem_new_alloc(pool, 60000);
+    assert_non_null(alloc1);
+    pool_segment_t exp1[4] =
+            {
+                    {60000, 1},
+                    {40000, 0},
+                    {60000, 1},
+                    {140000, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, GROW_SIZE, 120000, 2, 2);
+
+
+    assert_null(mem_new_alloc(pool, 150000));
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, GROW_SIZE, 120000, 2, 2);
+
+
+    void * alloc2 = mem_new_alloc(pool, 90000);
+    assert_non_null(alloc2);
+    void * alloc3 = mem_new_alloc(pool, 80000);
+    assert_non_null(alloc3);
+    pool_segment_t exp2[7] =
+            {
+                    {60000, 1},
+                    {40000, 0},
+                    {60000, 1},
+                    {90000, 1},
+                    {50000, 0},
+                    {80000, 1},
+                    {20000, 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, GROW_SIZE, 290000, 4, 3);
+
+
+    void * alloc4 = mem_new_alloc(pool, 30000);
+    assert_non_null(alloc4);
+    assert_null(mem_new_alloc(pool, 60000));
+    pool_segment_t exp3[8] =
+            {
+                    {60000, 1},
+                    {30000, 1},
+                    {10000, 0},
+                    {60000, 1},
+                    {90000, 1},
+                    {50000, 0},
+                    {80000, 1},
+                    {20000, 0}
+            };
+    check_pool(pool, exp3);
+    check_metadata(pool, FIRST_FIT, GROW_SIZE, 320000, 5, 3);
+    pool_usage_t usage = mem_pool_usage(pool);
+    assert_true(usage.reserved >= GROW_MAX_SIZE);
+
+
+    void * allocs[5] = {alloc0, alloc1, alloc2, alloc3, alloc4};
+    size_t sizes[5] = {60000, 60000, 90000, 80000, 30000};
+    for (int i = 0; i < 5; ++i) {
+        char *mem = mem_alloc_mem(pool, allocs[i]);
+        assert_non_null(mem);
+        assert_ptr_not_equal(mem, allocs[i]);
+        memset(mem, 0x10 + i, sizes[i]);
+    }
+    for (int i = 0; i < 5; ++i) {
+        char *mem = mem_alloc_mem(pool, allocs[i]);
+        assert_int_equal((unsigned char) mem[0], 0x10 + i);
+        assert_int_equal((unsigned char) mem[sizes[i] - 1], 0x10 + i);
+    }
+    check_pool(pool, exp3);
+    check_metadata(pool, FIRST_FIT, GROW_SIZE, 320000, 5, 3);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    pool_segment_t exp4[3] =
+            {
+                    {100000, 0},
+                    {200000, 0},
+                    {100000, 0}
+            };
+    check_pool(pool, exp4);
+    check_metadata(pool, FIRST_FIT, GROW_SIZE, 0, 0, 3);
+
+
+    assert_null(mem_pool_open_growable(GROW_SIZE, FIXED, GROW_MAX_SIZE));
+    assert_null(mem_pool_open_growable(GROW_SIZE, BUMP, GROW_MAX_SIZE));
+    assert_null(mem_pool_open_growable(GROW_SIZE, FIRST_FIT, GROW_SIZE - 1));
+    assert_null(mem_pool_open_growable(1000, FIRST_FIT, GROW_MAX_SIZE));
+}
+
+/*******************************************/
+/***        12. MAPPED SCENARIOS         ***/
+/*******************************************/
+
+static int pool_mmap_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = FIRST_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Mapping pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "FIRST_FIT");
+    pool = mem_pool_open_ex(POOL_SIZE, POOL_POLICY, POOL_MMAP);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static void test_pool_scenario35(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 35 (the pool memory is only reserved until it is used):
+     *
+     * 1. Nothing is committed after the open.
+     * 2. Allocate 100000, 100000 and 30000, and write all of them.
+     * 3. Deallocate the middle 100000 (its pages are given back).
+     * 4. Deallocate the 30000 (too few pages to give back at once).
+     * 5. Purge (the pages of the gap are given back, the first
+     *    allocation keeps its contents).
+     * 6. Deallocate the first 100000 (nothing is committed).
+     * 7. Allocate 200000 and 1000, write both, and shrink the 200000 to
+     *    50000 in place (the freed tail's pages are given back).
+     * 8. Shrink it to 10000 (too few pages to give back at once), and
+     *    purge (they are given back, the allocation keeps its contents).
+     */
+
+    pool_usage_t usage = mem_pool_usage(pool);
+    assert_true(usage.reserved >= POOL_SIZE);
+    assert_int_equal(usage.committed, 0);
+
+
+    void * alloc0 = mem_new_alloc(pool, 100000);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 100000);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 30000);
+    assert_non_null(alloc2);
+    memset(pool->mem, 0xa5, 230000);
+    usage = mem_pool_usage(pool);
+    assert_true(usage.committed >= 230000);
+    assert_true(usage.committed <= usage.reserved);
+    size_t written = usage.committed;
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    usage = mem_pool_usage(pool);
+    assert_true(usage.committed <= written - 90000);
+    size_t released = usage.committed;
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    usage = mem_pool_usage(pool);
+    assert_int_equal(usage.committed, released);
+
+
+    assert_int_equal(mem_pool_purge(pool), ALLOC_OK);
+    usage = mem_pool_usage(pool);
+    assert_true(usage.committed >= 100000);
+    assert_true(usage.committed < 110000);
+    assert_int_equal((unsigned char) pool->mem[99999], 0xa5);
+    pool_segment_t exp0[2] =
+            {
+                    {100000, 1},
+                    {POOL_SIZE - 100000, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100000, 1, 1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    usage = mem_pool_usage(pool);
+    assert_int_equal(usage.committed, 0);
+
+
+    alloc0 = mem_new_alloc(pool, 200000);
+    assert_non_null(alloc0);
+    alloc1 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc1);
+    memset(pool->mem, 0xa5, 201000);
+    usage = mem_pool_usage(pool);
+    written = usage.committed;
+    assert_ptr_equal(mem_realloc(pool, alloc0, 50000), alloc0);
+    usage = mem_pool_usage(pool);
+    assert_true(usage.committed <= written - 140000);
+    released = usage.committed;
+
+
+    assert_ptr_equal(mem_realloc(pool, alloc0, 10000), alloc0);
+    usage = mem_pool_usage(pool);
+    assert_int_equal(usage.committed, released);
+    assert_int_equal(mem_pool_purge(pool), ALLOC_OK);
+    usage = mem_pool_usage(pool);
+    assert_true(usage.committed >= 11000);
+    assert_true(usage.committed < 30000);
+    assert_int_equal((unsigned char) pool->mem[9999], 0xa5);
+    pool_segment_t exp1[4] =
+            {
+                    {10000, 1},
+                    {190000, 0},
+                    {1000, 1},
+                    {POOL_SIZE - 201000, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 11000, 2, 2);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+}
+
+static void test_pool_scenario40(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 40 (small deallocations add up in their gap):
+     *
+     * 1. Allocate 400 x 2048, and write all of them.
+     * 2. Deallocate them one by one, in order (each merges with the gap
+     *    before it, which gives its pages back every 64 KB).
+     * 3. Less than 64 KB and a page or so is left committed.
+     */
+
+    void * allocs[400];
+    for (int i = 0; i < 400; ++i) {
+        allocs[i] = mem_new_alloc(pool, 2048);
+        assert_non_null(allocs[i]);
+    }
+    memset(pool->mem, 0xa5, 400 * 2048);
+    pool_usage_t usage = mem_pool_usage(pool);
+    assert_true(usage.committed >= 400 * 2048);
+
+
+    for (int i = 0; i < 400; ++i) {
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    usage = mem_pool_usage(pool);
+    assert_true(usage.committed < 2 * 65536);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+// huge pages are 2 MB, the pool takes one
+static const size_t HUGE_PAGE_SIZE         = 2 * 1024 * 1024;
+
+static int pool_huge_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = FIRST_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Mapping pool of %lu bytes with policy %s in huge pages\n",
+         (long) POOL_SIZE, "FIRST_FIT");
+    pool = mem_pool_open_ex(POOL_SIZE, POOL_POLICY, POOL_HUGE);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static void test_pool_scenario36(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 36 (whether or not the system has huge pages, the pool
+     * is mapped as one):
+     *
+     * 1. The pool starts on a huge page and reserves a whole one.
+     * 2. Allocate 100000 and write it.
+     * 3. Deallocate it (the huge page is given back).
+     */
+
+    assert_int_equal((size_t) pool->mem % HUGE_PAGE_SIZE, 0);
+    pool_usage_t usage = mem_pool_usage(pool);
+    assert_int_equal(usage.reserved, HUGE_PAGE_SIZE);
+    assert_int_equal(usage.committed, 0);
+
+
+    void * alloc0 = mem_new_alloc(pool, 100000);
+    assert_non_null(alloc0);
+    memset(pool->mem, 0xa5, 100000);
+    usage = mem_pool_usage(pool);
+    assert_true(usage.committed >= 100000);
+    pool_segment_t exp0[2] =
+            {
+                    {100000, 1},
+                    {POOL_SIZE - 100000, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100000, 1, 1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    usage = mem_pool_usage(pool);
+    assert_int_equal(usage.committed, 0);
+}
+
+#define FILE_POOL_PATH "test_pool_file.mem"
+
+static void test_pool_scenario37(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Scenario 37 (the pool is kept in a file):
+     *
+     * 1. Open a pool in a new file, allocate 100, 200, 300, write the
+     *    200 and deallocate the 100.
+     * 2. Close it (the allocations stay in the file).
+     * 3. Reopening it with another policy or size fails.
+     * 4. Reopen it: the allocations, and what was written, are back,
+     *    and the 200 is found at its offset.
+     * 5. Deallocate both, sync, close and reopen it: it is empty.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    remove(FILE_POOL_PATH);
+
+    pool_pt pool = mem_pool_open_file(FILE_POOL_PATH, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+    memset(pool->mem + 100, 0x5a, 200);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+
+    assert_null(mem_pool_open_file(FILE_POOL_PATH, POOL_SIZE, BEST_FIT));
+    assert_null(mem_pool_open_file(FILE_POOL_PATH, POOL_SIZE / 2, FIRST_FIT));
+
+
+    pool = mem_pool_open_file(FILE_POOL_PATH, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    pool_segment_t exp0[4] =
+            {
+                    {100, 0},
+                    {200, 1},
+                    {300, 1},
+                    {POOL_SIZE - 600, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 500, 2, 2);
+    for (unsigned i = 100; i < 300; ++i) {
+        assert_int_equal((unsigned char) pool->mem[i], 0x5a);
+    }
+    alloc1 = mem_find_alloc(pool, 100);
+    assert_non_null(alloc1);
+    alloc2 = mem_find_alloc(pool, 300);
+    assert_non_null(alloc2);
+    assert_null(mem_find_alloc(pool, 0));
+    assert_null(mem_find_alloc(pool, 150));
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_pool_sync(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    pool = mem_pool_open_file(FILE_POOL_PATH, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    pool_segment_t exp1[1] =
+            {
+                    {POOL_SIZE, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+    assert_int_equal(remove(FILE_POOL_PATH), 0);
+}
+
+static void test_pool_scenario39(void **state) {
+    (void) state; /* unused */
+
+    const alloc_policy policies[4] = { FIRST_FIT, BEST_FIT, TLSF_FIT, NEXT_FIT };
+
+    /*
+     * Scenario 39 (a zero-byte allocation in a file, for every policy
+     * that can keep its pool in a file):
+     *
+     * 1. Open a pool in a new file, allocate 100, 0, 200 and sync.
+     * 2. Deallocate the 100, sync and close it.
+     * 3. Reopen it: the 0 and the 200 are back, both at offset 100.
+     * 4. Clean up.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    for (unsigned i = 0; i < 4; ++i) {
+        remove(FILE_POOL_PATH);
+
+        pool_pt pool = mem_pool_open_file(FILE_POOL_PATH, POOL_SIZE, policies[i]);
+        assert_non_null(pool);
+        void * alloc0 = mem_new_alloc(pool, 100);
+        assert_non_null(alloc0);
+        void * alloc1 = mem_new_alloc(pool, 0);
+        assert_non_null(alloc1);
+        void * alloc2 = mem_new_alloc(pool, 200);
+        assert_non_null(alloc2);
+        assert_int_equal(mem_pool_sync(pool), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+        assert_int_equal(mem_pool_sync(pool), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+
+        pool = mem_pool_open_file(FILE_POOL_PATH, POOL_SIZE, policies[i]);
+        assert_non_null(pool);
+        pool_segment_t exp0[4] =
+                {
+                        {100, 0},
+                        {0, 1},
+                        {200, 1},
+                        {POOL_SIZE - 300, 0}
+                };
+        check_pool(pool, exp0);
+        check_metadata(pool, policies[i], POOL_SIZE, 200, 2, 2);
+        assert_non_null(mem_find_alloc(pool, 100));
+
+
+        // clean up
+        assert_int_equal(mem_pool_close_force(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+    assert_int_equal(remove(FILE_POOL_PATH), 0);
+}
+
+/*******************************************/
+/***       13. STRESS TESTING            ***/
+/*******************************************/
+
+void test_pool_stresstest0(void **state) {
+    (void) state; /* unused */
+
+    const unsigned num_pools = 200;
+    const unsigned num_allocations = 1000; // 1000
+    const unsigned min_alloc_size = 10;
+    const unsigned pool_size =
+            (num_allocations / 2) *
+            (2 * min_alloc_size + (num_allocations - 1) * min_alloc_size);
+    assert_int_equal(pool_size, 5005000);
+
+
+    pool_pt pools[num_pools];
+    void *allocations[num_pools][num_allocations];
+
+    /*
+     * Testing dynamic reallocation of pool structures:
+     *
+     * 1. 200 pools of 5005000 each (many pools)
+     * 2. In each pool 1000 allocations of different sizes (many allocations)
+     * 3. In each pool 500 deallocations (many gaps)
+     */
+
+    // initialize store
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // allocate pools
+    for (unsigned pix=0; pix < num_pools; ++pix) {
+        // open pool
+        pools[pix] =
+                mem_pool_open(pool_size, (pix % 2) ? FIRST_FIT : BEST_FIT);
+        assert_non_null(pools[pix]);
+        
+        // allocate pool
+        unsigned allocated = 0;
+        for (unsigned aix=0; aix < num_allocations; ++aix) {
+            allocations[pix][aix] =
+                    mem_new_alloc(pools[pix], (aix + 1) * min_alloc_size);
+            allocated += (aix + 1) * min_alloc_size;
+            if (!allocations[pix][aix]) {
+                INFO("ASSERT WILL FAIL at pix = %u, aix = %u, allocated = %u\n", pix, aix, allocated);
+            }
+            assert_non_null(allocations[pix][aix]);
+        }
+
+        // delete every other allocation
+        for (unsigned aix=0; aix < num_allocations; ++aix) {
+            if (aix % 2) {
+                assert_int_equal(
+                        mem_del_alloc(pools[pix], allocations[pix][aix]),
                         ALLOC_OK);
                 allocations[pix][aix] = NULL;
             }
@@ -2396,9 +4409,477 @@ void test_pool_stresstest0(void **state) {
     assert_int_equal(mem_free(), ALLOC_OK);
 }
 
+static double stress_now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#ifdef MEM_POOL_THREAD_SAFE
+
+/*
+ * Multi-threaded stress testing: cmocka asserts must stay on the main
+ * thread, so the workers count their failures and the test checks them.
+ */
+
+static const unsigned STRESS_NUM_THREADS  = 8;
+static const unsigned STRESS_NUM_POOLS    = 64;   // split among the threads
+static const unsigned STRESS_NUM_ALLOCS   = 1000;
+static const unsigned STRESS_MIN_ALLOC    = 10;
+
+typedef struct _stress_job {
+    unsigned first_pool;
+    unsigned num_pools;
+    pool_pt shared;         // the pool all threads allocate from, if any
+    unsigned seed;
+    unsigned failures;
+} stress_job_t;
+
+// the workload of test_pool_stresstest0 on pools of the thread's own
+static void *stress_own_pools(void *arg) {
+    stress_job_t *job = arg;
+    const size_t pool_size = (STRESS_NUM_ALLOCS / 2) *
+            (2 * STRESS_MIN_ALLOC + (STRESS_NUM_ALLOCS - 1) * STRESS_MIN_ALLOC);
+    void **allocations = calloc(STRESS_NUM_ALLOCS, sizeof(void *));
+    if (allocations == NULL) {
+        ++job->failures;
+        return NULL;
+    }
+
+    for (unsigned pix = job->first_pool; pix < job->first_pool + job->num_pools; ++pix) {
+        pool_pt pool = mem_pool_open(pool_size, (pix % 2) ? FIRST_FIT : BEST_FIT);
+        if (pool == NULL) {
+            ++job->failures;
+            continue;
+        }
+        for (unsigned aix = 0; aix < STRESS_NUM_ALLOCS; ++aix) {
+            allocations[aix] = mem_new_alloc(pool, (aix + 1) * STRESS_MIN_ALLOC);
+            job->failures += (allocations[aix] == NULL);
+        }
+        // delete every other allocation, then the rest
+        for (unsigned pass = 1; pass <= 2; ++pass) {
+            for (unsigned aix = 0; aix < STRESS_NUM_ALLOCS; ++aix) {
+                if (allocations[aix] != NULL && (pass == 2 || aix % 2)) {
+                    job->failures += (mem_del_alloc(pool, allocations[aix]) != ALLOC_OK);
+                    allocations[aix] = NULL;
+                }
+            }
+        }
+        job->failures += (mem_pool_close(pool) != ALLOC_OK);
+    }
+
+    free(allocations);
+    return NULL;
+}
+
+// random allocations and deallocations on a pool shared by all threads;
+// each allocation is filled with a tag that must survive until it is freed
+static void *stress_shared_pool(void *arg) {
+    stress_job_t *job = arg;
+    enum { SLOTS = 64 };
+    void *allocs[SLOTS] = { NULL };
+    size_t sizes[SLOTS];
+    unsigned seed = job->seed;
+
+    for (unsigned i = 0; i < 20000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        unsigned slot = (seed >> 16) % SLOTS;
+        unsigned char tag = (unsigned char) (job->seed + slot);
+        if (allocs[slot] == NULL) {
+            sizes[slot] = 1 + (seed >> 8) % 500;
+            allocs[slot] = mem_new_alloc(job->shared, sizes[slot]);
+            if (allocs[slot] != NULL) {
+                memset(mem_alloc_mem(job->shared, allocs[slot]), tag, sizes[slot]);
+            }
+        } else {
+            unsigned char *mem = mem_alloc_mem(job->shared, allocs[slot]);
+            for (size_t b = 0; b < sizes[slot]; ++b) {
+                if (mem[b] != tag) {
+                    ++job->failures;
+                    break;
+                }
+            }
+            job->failures += (mem_del_alloc(job->shared, allocs[slot]) != ALLOC_OK);
+            allocs[slot] = NULL;
+        }
+    }
+    for (unsigned slot = 0; slot < SLOTS; ++slot) {
+        if (allocs[slot] != NULL) {
+            job->failures += (mem_del_alloc(job->shared, allocs[slot]) != ALLOC_OK);
+        }
+    }
+    job->failures += (mem_pool_flush_cache(job->shared) != ALLOC_OK);
+    return NULL;
+}
+
+// allocations handed through a ring from the threads that make them to the
+// threads that free them, as messages in a pipeline are
+enum { PIPE_SLOTS = 256, PIPE_MESSAGES = 20000 };
+
+typedef struct _stress_pipe {
+    pool_pt pool;
+    void *ring[PIPE_SLOTS];
+    unsigned head, tail;    // messages put in and taken out
+    unsigned producers;     // still putting messages in
+    unsigned failures;
+    pthread_mutex_t lock;
+} stress_pipe_t;
+
+static void *stress_producer(void *arg) {
+    stress_pipe_t *pipe = arg;
+
+    for (unsigned i = 0; i < PIPE_MESSAGES; ++i) {
+        void *msg = mem_new_alloc(pipe->pool, 16 + i % 1000);
+        pthread_mutex_lock(&pipe->lock);
+        if (msg == NULL) {
+            ++pipe->failures;
+        }
+        while (msg != NULL) {
+            if (pipe->head - pipe->tail < PIPE_SLOTS) {
+                pipe->ring[pipe->head++ % PIPE_SLOTS] = msg;
+                msg = NULL;
+            } else {
+                // the ring is full, let the consumers catch up
+                pthread_mutex_unlock(&pipe->lock);
+                pthread_mutex_lock(&pipe->lock);
+            }
+        }
+        pthread_mutex_unlock(&pipe->lock);
+    }
+
+    pthread_mutex_lock(&pipe->lock);
+    --pipe->producers;
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
+
+static void *stress_consumer(void *arg) {
+    stress_pipe_t *pipe = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&pipe->lock);
+        void *msg = (pipe->tail < pipe->head) ? pipe->ring[pipe->tail++ % PIPE_SLOTS] : NULL;
+        unsigned producers = pipe->producers;
+        pthread_mutex_unlock(&pipe->lock);
+
+        if (msg != NULL) {
+            if (mem_del_alloc(pipe->pool, msg) != ALLOC_OK) {
+                pthread_mutex_lock(&pipe->lock);
+                ++pipe->failures;
+                pthread_mutex_unlock(&pipe->lock);
+            }
+        } else if (producers == 0) {
+            return NULL;
+        }
+    }
+}
+
+// half the threads allocate messages, the other half free them
+static unsigned stress_pipeline(pool_pt pool) {
+    pthread_t threads[STRESS_NUM_THREADS];
+    stress_pipe_t pipe = { .pool = pool, .producers = STRESS_NUM_THREADS / 2 };
+    pthread_mutex_init(&pipe.lock, NULL);
+
+    for (unsigned t = 0; t < STRESS_NUM_THREADS; ++t) {
+        assert_int_equal(pthread_create(&threads[t], NULL,
+                                        (t % 2) ? stress_consumer : stress_producer,
+                                        &pipe), 0);
+    }
+    for (unsigned t = 0; t < STRESS_NUM_THREADS; ++t) {
+        assert_int_equal(pthread_join(threads[t], NULL), 0);
+    }
+    pthread_mutex_destroy(&pipe.lock);
+    return pipe.failures;
+}
+
+// every allocation freed twice in a row while another thread keeps the
+// pool busy, so the first free is often left on the remote free list; the
+// second one must fail either way. Racing, two threads free each
+// allocation once at the same time, and only one of them may succeed.
+enum { TWICE_ALLOCS = 2048, TWICE_FREERS = 4 };
+enum { TWICE_STARTING, TWICE_BUSY, TWICE_DONE };
+
+typedef struct _stress_twice {
+    pool_pt pool;
+    void **allocs;
+    unsigned first, num;
+    int racing;
+    unsigned freed;
+    unsigned failures;
+    unsigned *phase;
+} stress_twice_t;
+
+static void *stress_free_twice(void *arg) {
+    stress_twice_t *job = arg;
+
+    while (__atomic_load_n(job->phase, __ATOMIC_ACQUIRE) == TWICE_STARTING) {
+        sched_yield();
+    }
+    for (unsigned i = job->first; i < job->first + job->num; ++i) {
+        if (job->racing) {
+            job->freed += (mem_del_alloc(job->pool, job->allocs[i]) == ALLOC_OK);
+            continue;
+        }
+        job->failures += (mem_del_alloc(job->pool, job->allocs[i]) != ALLOC_OK);
+        job->failures += (mem_del_alloc(job->pool, job->allocs[i]) != ALLOC_FAIL);
+    }
+    return NULL;
+}
+
+// (without allocating, which could hand out a freed handle again)
+static void *stress_keep_busy(void *arg) {
+    stress_twice_t *job = arg;
+
+    __atomic_store_n(job->phase, TWICE_BUSY, __ATOMIC_RELEASE);
+    while (__atomic_load_n(job->phase, __ATOMIC_ACQUIRE) == TWICE_BUSY) {
+        pool_segment_pt segments = NULL;
+        unsigned num_segments = 0;
+        mem_inspect_pool(job->pool, &segments, &num_segments);
+        job->failures += (segments == NULL);
+        free(segments);
+    }
+    return NULL;
+}
+
+static unsigned stress_double_free(pool_pt pool, size_t size, int racing) {
+    pthread_t threads[TWICE_FREERS + 1];
+    stress_twice_t jobs[TWICE_FREERS + 1];
+    void **allocs = calloc(TWICE_ALLOCS, sizeof(void *));
+    unsigned phase = TWICE_STARTING;
+    unsigned failures = 0;
+    unsigned freed = 0;
+    assert_non_null(allocs);
+
+    for (unsigned i = 0; i < TWICE_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, size);
+        assert_non_null(allocs[i]);
+    }
+    // racing, threads 2k and 2k + 1 free the same allocations
+    unsigned num_ranges = racing ? TWICE_FREERS / 2 : TWICE_FREERS;
+    for (unsigned t = 0; t <= TWICE_FREERS; ++t) {
+        unsigned range = racing ? t / 2 : t;
+        jobs[t] = (stress_twice_t) { .pool = pool, .allocs = allocs, .phase = &phase,
+                                     .first = range * (TWICE_ALLOCS / num_ranges),
+                                     .num = TWICE_ALLOCS / num_ranges, .racing = racing };
+        assert_int_equal(pthread_create(&threads[t], NULL,
+                                        (t < TWICE_FREERS) ? stress_free_twice : stress_keep_busy,
+                                        &jobs[t]), 0);
+    }
+    for (unsigned t = 0; t <= TWICE_FREERS; ++t) {
+        if (t == TWICE_FREERS) {
+            __atomic_store_n(&phase, TWICE_DONE, __ATOMIC_RELEASE);
+        }
+        assert_int_equal(pthread_join(threads[t], NULL), 0);
+        failures += jobs[t].failures;
+        freed += jobs[t].freed;
+    }
+    if (racing) {
+        failures += (freed != TWICE_ALLOCS);
+    }
+    free(allocs);
+    return failures;
+}
+
+static unsigned stress_run(unsigned num_threads, pool_pt shared) {
+    pthread_t threads[STRESS_NUM_THREADS];
+    stress_job_t jobs[STRESS_NUM_THREADS];
+    unsigned failures = 0;
+
+    for (unsigned t = 0; t < num_threads; ++t) {
+        jobs[t].first_pool = t * (STRESS_NUM_POOLS / num_threads);
+        jobs[t].num_pools = STRESS_NUM_POOLS / num_threads;
+        jobs[t].shared = shared;
+        jobs[t].seed = 17 * (t + 1);
+        jobs[t].failures = 0;
+        assert_int_equal(pthread_create(&threads[t], NULL,
+                                        (shared != NULL) ? stress_shared_pool : stress_own_pools,
+                                        &jobs[t]), 0);
+    }
+    for (unsigned t = 0; t < num_threads; ++t) {
+        assert_int_equal(pthread_join(threads[t], NULL), 0);
+        failures += jobs[t].failures;
+    }
+    return failures;
+}
+
+void test_pool_stresstest1(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Testing concurrent use of the library:
+     *
+     * 1. The pools of test_pool_stresstest0, split among 1 and then
+     *    8 threads that open, use and close their own pools (pools run
+     *    in parallel, the pool store is shared)
+     * 2. 8 threads allocating from and deallocating to one slab pool,
+     *    without and with thread caches, and to one pool of 8 shards
+     * 3. 4 threads allocating messages that 4 other threads deallocate,
+     *    in one pool and in one pool of 8 shards
+     * 4. 4 threads deallocating every allocation twice while another
+     *    thread keeps the pool busy, in one pool, one pool of 8 shards and
+     *    one FIXED pool (each second deallocation should not succeed),
+     *    then 2 pairs of threads deallocating the same allocations at the
+     *    same time (one of each pair of deallocations should succeed)
+     */
+
+    // initialize store
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // the same pools on one thread and on many
+    double start = stress_now();
+    assert_int_equal(stress_run(1, NULL), 0);
+    double serial = stress_now() - start;
+
+    start = stress_now();
+    assert_int_equal(stress_run(STRESS_NUM_THREADS, NULL), 0);
+    double parallel = stress_now() - start;
+
+    INFO("%u pools: %.3f s on 1 thread, %.3f s on %u threads (%.1fx)\n",
+         STRESS_NUM_POOLS, serial, parallel, STRESS_NUM_THREADS, serial / parallel);
+
+    // one pool for all threads, with slabs for the small allocations,
+    // then with a cache per thread in front of them, then in shards
+    double shared_time[3];
+    for (unsigned i = 0; i < 3; ++i) {
+        pool_pt shared = (i < 2) ?
+                mem_pool_open_ex(POOL_SIZE, FIRST_FIT, (i == 0) ? POOL_SLAB : POOL_TCACHE) :
+                mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, STRESS_NUM_THREADS);
+        assert_non_null(shared);
+        start = stress_now();
+        assert_int_equal(stress_run(STRESS_NUM_THREADS, shared), 0);
+        shared_time[i] = stress_now() - start;
+        // (the last slab of each class stays until the pool is closed)
+        assert_int_equal(shared->alloc_size, 0);
+        assert_int_equal(shared->num_allocs, 0);
+        assert_int_equal(mem_pool_close(shared), ALLOC_OK);
+    }
+
+    INFO("shared pool on %u threads: %.3f s, %.3f s with thread caches, %.3f s in shards\n",
+         STRESS_NUM_THREADS, shared_time[0], shared_time[1], shared_time[2]);
+
+    // messages freed on other threads than they were allocated on; frees
+    // that find the pool busy are left to the next thread to lock it, and
+    // closing the pool does those that are left
+    for (unsigned i = 0; i < 2; ++i) {
+        pool_pt piped = (i == 0) ?
+                mem_pool_open(POOL_SIZE, FIRST_FIT) :
+                mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, STRESS_NUM_THREADS);
+        assert_non_null(piped);
+        assert_int_equal(stress_pipeline(piped), 0);
+        assert_int_equal(mem_pool_close(piped), ALLOC_OK);
+    }
+
+    // a double free that finds the pool busy is caught as one that doesn't,
+    // and of two frees at the same time one is caught
+    for (unsigned i = 0; i < 6; ++i) {
+        pool_pt twice = (i % 3 == 0) ? mem_pool_open(POOL_SIZE, FIRST_FIT) :
+                        (i % 3 == 1) ? mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, STRESS_NUM_THREADS) :
+                        mem_pool_open_fixed(64, TWICE_ALLOCS + 1);
+        assert_non_null(twice);
+        assert_int_equal(stress_double_free(twice, 16, i >= 3), 0);
+        // the frees left on the remote free lists are done by then
+        pool_segment_pt segments = NULL;
+        unsigned num_segments = 0;
+        mem_inspect_pool(twice, &segments, &num_segments);
+        assert_non_null(segments);
+        free(segments);
+        assert_int_equal(twice->num_allocs, 0);
+        assert_int_equal(twice->alloc_size, 0);
+        assert_int_equal(mem_pool_close(twice), ALLOC_OK);
+    }
+
+    // free store
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+#endif
+
+/*
+ * Huge page benchmark: random reads over many small allocations, which
+ * miss the TLB on nearly every access unless the pages are large.
+ */
+
+static const size_t BENCH_POOL_SIZE     = 128 * 1024 * 1024;
+static const size_t BENCH_RECORD_SIZE   = 64;
+static const unsigned BENCH_STEPS       = 1 << 22;
+
+typedef struct _bench_record {
+    struct _bench_record *next;
+    size_t index;
+} bench_record_t;
+
+// link every record of a BUMP pool into one random cycle and follow it,
+// returning the time the walk took and the sum of the indices it saw
+static double bench_chase(unsigned flags, size_t *sum) {
+    pool_pt pool = mem_pool_open_ex(BENCH_POOL_SIZE, BUMP, flags);
+    assert_non_null(pool);
+    const size_t num_records = BENCH_POOL_SIZE / BENCH_RECORD_SIZE;
+    bench_record_t **records = malloc(num_records * sizeof(bench_record_t *));
+    assert_non_null(records);
+
+    for (size_t i = 0; i < num_records; ++i) {
+        records[i] = mem_new_alloc(pool, BENCH_RECORD_SIZE);
+        assert_non_null(records[i]);
+        records[i]->index = i;
+    }
+    // Sattolo's shuffle, so that the records make a single cycle
+    unsigned seed = 12345;
+    for (size_t i = num_records - 1; i > 0; --i) {
+        seed = seed * 1103515245 + 12345;
+        size_t j = (((size_t) seed << 16) ^ (seed >> 16)) % i;
+        bench_record_t *tmp = records[i];
+        records[i] = records[j];
+        records[j] = tmp;
+    }
+    for (size_t i = 0; i < num_records; ++i) {
+        records[i]->next = records[(i + 1) % num_records];
+    }
+    bench_record_t *record = records[0];
+    free(records);
+
+    double start = stress_now();
+    size_t total = 0;
+    for (unsigned step = 0; step < BENCH_STEPS; ++step) {
+        total += record->index;
+        record = record->next;
+    }
+    double elapsed = stress_now() - start;
+
+    *sum = total;
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    return elapsed;
+}
+
+void test_pool_stresstest2(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Benchmarking huge pages:
+     *
+     * 1. 2M records of 64 bytes in a mapped 128 MB BUMP pool, linked in
+     *    random order and followed 4M times
+     * 2. The same in a pool of huge pages (the walk sees the same
+     *    records, in the same order)
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    size_t small_sum = 0;
+    size_t huge_sum = 0;
+    double small_time = bench_chase(POOL_MMAP, &small_sum);
+    double huge_time = bench_chase(POOL_HUGE, &huge_sum);
+    assert_true(small_sum == huge_sum);
+    INFO("%u random reads over %lu MB: %.3f s in small pages, %.3f s in huge pages (%.1fx)\n",
+         BENCH_STEPS, (unsigned long) (BENCH_POOL_SIZE >> 20), small_time, huge_time,
+         small_time / huge_time);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
 
 /*******************************************/
-/***         6. DRIVER ROUTINE           ***/
+/***        14. DRIVER ROUTINE           ***/
 /*******************************************/
 
 int run_test_suite() {
@@ -2408,6 +4889,7 @@ int run_test_suite() {
             cmocka_unit_test(test_pool_store_smoketest),
             cmocka_unit_test(test_pool_smoketest),
             cmocka_unit_test(test_pool_nonempty),
+            cmocka_unit_test(test_pool_force_close),
 
             cmocka_unit_test_setup_teardown(test_pool_ff_metadata, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_bf_metadata, pool_bf_setup, pool_bf_teardown),
@@ -2424,6 +4906,14 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario08, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario09, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario10, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario24, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario26, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario27, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario28, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario29, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario30, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario38, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_pool_scenario41),
 
             // Best-fit tests
             cmocka_unit_test_setup_teardown(test_pool_scenario11, pool_bf_setup, pool_bf_teardown),
@@ -2435,9 +4925,43 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario17, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
+
+            // TLSF-fit tests
+            cmocka_unit_test_setup_teardown(test_pool_scenario20, pool_tlsf_setup, pool_tlsf_teardown),
+
+            // Next-fit tests
+            cmocka_unit_test_setup_teardown(test_pool_scenario21, pool_nf_setup, pool_nf_teardown),
+
+            // Buddy tests
+            cmocka_unit_test_setup_teardown(test_pool_scenario22, pool_buddy_setup, pool_buddy_teardown),
+
+            // Slab tests
+            cmocka_unit_test_setup_teardown(test_pool_scenario23, pool_slab_setup, pool_slab_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario32, pool_tcache_setup, pool_slab_teardown),
+
+            // Fixed-size block tests
+            cmocka_unit_test_setup_teardown(test_pool_scenario25, pool_fixed_setup, pool_fixed_teardown),
+
+            // Bump tests
+            cmocka_unit_test_setup_teardown(test_pool_scenario31, pool_bump_setup, pool_bump_teardown),
+
+            // Sharded tests
+            cmocka_unit_test_setup_teardown(test_pool_scenario33, pool_sharded_setup, pool_sharded_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario34, pool_growable_setup, pool_sharded_teardown),
+
+            // Mapped tests
+            cmocka_unit_test_setup_teardown(test_pool_scenario35, pool_mmap_setup, pool_sharded_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario40, pool_mmap_setup, pool_sharded_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario36, pool_huge_setup, pool_sharded_teardown),
+            cmocka_unit_test(test_pool_scenario37),
+            cmocka_unit_test(test_pool_scenario39),
             //*/
             // Stress tests
             cmocka_unit_test(test_pool_stresstest0),
+#ifdef MEM_POOL_THREAD_SAFE
+            cmocka_unit_test(test_pool_stresstest1),
+#endif
+            cmocka_unit_test(test_pool_stresstest2),
     };
 
     return cmocka_run_group_tests_name("pool_test_suite", tests, NULL, NULL);